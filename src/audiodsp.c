@@ -0,0 +1,68 @@
+#include "audiodsp.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Size of the destination block kept hot in L1 while all planes are
+ * scattered into it */
+#define INTERLEAVE_BLOCK_BYTES 16384
+
+static void interleave_stereo_f32(gfloat *restrict dst,
+                                  const gfloat *restrict left,
+                                  const gfloat *restrict right, gsize frames) {
+  for (gsize i = 0; i < frames; i++) {
+    dst[2 * i] = left[i];
+    dst[2 * i + 1] = right[i];
+  }
+}
+
+void gst_roc_interleave_f32(gfloat *dst, const gfloat *const *planes,
+                            guint channels, gsize frames) {
+  if (channels == 1) {
+    memcpy(dst, planes[0], frames * sizeof(gfloat));
+    return;
+  }
+  if (channels == 2) {
+    interleave_stereo_f32(dst, planes[0], planes[1], frames);
+    return;
+  }
+
+  /* Walk the output in blocks small enough to stay in cache, so each plane
+   * is read sequentially and the strided stores hit the same lines */
+  const gsize block =
+      MAX(8, INTERLEAVE_BLOCK_BYTES / (channels * sizeof(gfloat)));
+  for (gsize start = 0; start < frames; start += block) {
+    const gsize n = MIN(block, frames - start);
+    gfloat *restrict out = dst + start * channels;
+    for (guint ch = 0; ch < channels; ch++) {
+      const gfloat *restrict in = planes[ch] + start;
+      for (gsize i = 0; i < n; i++)
+        out[i * channels + ch] = in[i];
+    }
+  }
+}
+
+/* Independent accumulators let the compiler keep the reduction in vector
+ * registers without -ffast-math */
+#define PEAK_LANES 8
+
+gfloat gst_roc_peak_f32(const gfloat *samples, gsize n) {
+  gfloat acc[PEAK_LANES] = {0};
+  gsize i = 0;
+
+  for (; i + PEAK_LANES <= n; i += PEAK_LANES) {
+    for (guint l = 0; l < PEAK_LANES; l++) {
+      const gfloat v = fabsf(samples[i + l]);
+      acc[l] = v > acc[l] ? v : acc[l];
+    }
+  }
+  for (; i < n; i++) {
+    const gfloat v = fabsf(samples[i]);
+    acc[0] = v > acc[0] ? v : acc[0];
+  }
+
+  gfloat peak = acc[0];
+  for (guint l = 1; l < PEAK_LANES; l++)
+    peak = acc[l] > peak ? acc[l] : peak;
+  return peak;
+}
@@ -0,0 +1,13 @@
+#ifndef AUDIODSP_H__
+#define AUDIODSP_H__
+
+#include <glib.h>
+
+/* Interleave @channels planes of @frames float samples each into @dst */
+void gst_roc_interleave_f32(gfloat *dst, const gfloat *const *planes,
+                            guint channels, gsize frames);
+
+/* Largest absolute sample value among @n samples */
+gfloat gst_roc_peak_f32(const gfloat *samples, gsize n);
+
+#endif /* AUDIODSP_H__ */
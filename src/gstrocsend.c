@@ -2,7 +2,11 @@
 // #include "gst/gstinfo.h"
 // #include "gst/gstmemory.h"
 // #include "gst/gstpad.h"
+#include "audiodsp.h"
 #include "common.h"
+#include "gstrocsendtracer.h"
+#include "pcapwriter.h"
+#include "probes.h"
 #include "glib.h"
 #include "glibconfig.h"
 #include "gst/gstbuffer.h"
@@ -11,7 +15,9 @@
 #include "gst/gstpad.h"
 #include <gst/audio/audio.h>
 #include <gst/gst.h>
+#include <gst/rtp/gstrtcpbuffer.h>
 #include <gst/rtp/gstrtpbuffer.h>
+#include <math.h>
 #include <roc/config.h>
 #include <roc/context.h>
 #include <roc/packet.h>
@@ -21,10 +27,106 @@ GST_DEBUG_CATEGORY_EXTERN(roc_toolkit_debug);
 GST_DEBUG_CATEGORY_STATIC(gst_rocsend_debug);
 #define GST_CAT_DEFAULT gst_rocsend_debug
 #define DEFAULT_MTU 1492
+/* ROC uses this packet length when packet-length is 0 */
+#define DEFAULT_PACKET_LENGTH (5 * GST_MSECOND)
+/* Amount of audio an upstream pool buffer should roughly carry */
+#define ALLOCATION_BUFFER_DURATION (10 * GST_MSECOND)
+/* SIMD-friendly alignment (mask) for proposed input buffers */
+#define ALLOCATION_ALIGN 63
+/* Size of buffers handed to the encoder to pop RTP and RTCP packets into */
+#define PACKET_BUFFER_SIZE 2048
+#define PACKET_POOL_MIN_BUFFERS 16
+
+#define DEFAULT_DTX FALSE
+#define DEFAULT_DTX_THRESHOLD -60.0
+#define DEFAULT_DTX_HANGOVER (200 * GST_MSECOND)
+#define DEFAULT_DTX_KEEPALIVE (500 * GST_MSECOND)
+
+#define DEFAULT_RTX_HISTORY_SIZE 0
+#define DEFAULT_RTX_HISTORY_MAX_BYTES (1024 * 1024)
+#define DEFAULT_RTX_PAYLOAD_TYPE 97
+
+#define DEFAULT_MAX_LATENESS -1
+
+#define DEFAULT_DRIFT_COMPENSATION FALSE
+/* Arrival delay against the sample count is sampled, as its minimum, once
+ * per this much pipeline clock time */
+#define DRIFT_WINDOW GST_SECOND
+/* The rate is the slope across this many windows */
+#define DRIFT_POINTS 16
+/* Weight of each new estimate once the span is full */
+#define DRIFT_FILTER_ALPHA 0.1
+/* Windows off by more than this are stalls or glitches, not drift */
+#define DRIFT_MAX_PPM 1000.0
+/* Resampler rates are the stream rate times this, for sub-ppm steps */
+#define DRIFT_RATE_SCALE 1000
+#define DEFAULT_LATE_POLICY GST_ROCSEND_LATE_POLICY_DROP
+
+#define DEFAULT_USE_PIPELINE_CLOCK FALSE
+
+#define DEFAULT_DUMP_ROTATE_SIZE (100 * 1024 * 1024)
+
+#define DEFAULT_FEEDBACK_HANDOFF FALSE
+/* Feedback packets waiting for the streaming thread, a power of two */
+#define FEEDBACK_QUEUE_SIZE 64
+
+#define DEFAULT_PACING FALSE
+#define DEFAULT_MAX_BURST 1
+/* Packets and events held for the pacing task before the chain blocks */
+#define PACING_QUEUE_SIZE 256
 
 #define GST_TYPE_ROCSEND (gst_rocsend_get_type())
 G_DECLARE_FINAL_TYPE(GstRocSend, gst_rocsend, GST, ROCSEND, GstElement)
 
+typedef enum {
+  GST_ROCSEND_LATE_POLICY_DROP,
+  GST_ROCSEND_LATE_POLICY_SKIP,
+} GstRocSendLatePolicy;
+
+#define GST_TYPE_ROCSEND_LATE_POLICY (gst_rocsend_late_policy_get_type())
+static GType gst_rocsend_late_policy_get_type(void) {
+  static GType type = 0;
+  static const GEnumValue values[] = {
+      {GST_ROCSEND_LATE_POLICY_DROP,
+       "Drop late input, the stream closes the gap unless it is on the "
+       "pipeline clock timebase",
+       "drop"},
+      {GST_ROCSEND_LATE_POLICY_SKIP,
+       "Drop late input and skip RTP timestamps over it", "skip"},
+      {0, NULL, NULL},
+  };
+
+  if (g_once_init_enter(&type)) {
+    GType tmp = g_enum_register_static("GstRocSendLatePolicy", values);
+    g_once_init_leave(&type, tmp);
+  }
+  return type;
+}
+
+typedef struct {
+  guint16 seq;
+  GstBuffer *buffer; /* ref to the pushed RTP packet, NULL if empty */
+} GstRocSendHistoryEntry;
+
+typedef struct {
+  gsize size;
+  guint8 data[PACKET_BUFFER_SIZE];
+} GstRocSendFeedbackSlot;
+
+/* Tuning properties that may change while PLAYING. set_property publishes a
+ * copy and the streaming thread adopts it at the next buffer boundary */
+typedef struct {
+  guint packet_encoding;
+  guint64 packet_length;
+  gboolean dtx;
+  gdouble dtx_threshold;      /* dBFS */
+  GstClockTime dtx_hangover;  /* silence before suppression starts */
+  GstClockTime dtx_keepalive; /* packet interval while suppressing */
+  gint64 max_lateness;        /* -1 disables late input handling */
+  GstRocSendLatePolicy late_policy;
+  gboolean drift_compensation;
+} GstRocSendSettings;
+
 /* Configuration state collected before encoder initialization */
 typedef struct {
   /* From caps negotiation */
@@ -56,6 +158,7 @@ struct _GstRocSend {
   /* RTCP pads */
   GstPad *rtcp_src_pad;  /* RTCP packets output (request pad) */
   GstPad *rtcp_sink_pad; /* RTCP feedback input (request pad) */
+  GstPad *rtx_src_pad;   /* RFC 4588 retransmissions (request pad) */
 
   /* Configuration state for deferred initialization */
   GstRocSendConfig config_state;
@@ -64,16 +167,174 @@ struct _GstRocSend {
   gboolean encoder_activated;
   gboolean rtcp_interface_activated;
   GstCaps *negotiated_caps;
+  GstAudioInfo audio_info;
 
-  /* ROC sender configuration properties */
-  guint packet_encoding;
-  guint64 packet_length;
+  /* Recycled buffers for popped RTP/RTCP packets, active while streaming */
+  GstBufferPool *packet_pool;
+
+  /* Reusable interleaved frame for non-interleaved or remixed input */
+  gfloat *frame_buf;
+  gsize frame_buf_size; /* in bytes */
+
+  /* Channel remapping in front of the encoder */
+  GstAudioChannelMixer *mixer;
+  gint frame_channels; /* channels in frames pushed to the encoder */
+
+  /* Tuning properties: as set (object lock), as published for the streaming
+   * thread (atomic, owned), and as used by the streaming thread */
+  GstRocSendSettings settings;
+  gpointer pending_settings;
+  GstRocSendSettings active;
+
+  /* Channel mixing */
+  GValue mix_matrix;
+  gboolean downmix;
+
+  /* NACK-driven retransmission */
+  guint rtx_history_size;      /* packets kept, 0 disables history */
+  guint64 rtx_history_max_bytes; /* cap on bytes kept, 0 is unlimited */
+  guint rtx_payload_type;        /* protected by rtx_lock */
+
+  /* Startup tuning */
+  GstCaps *prewarm_caps;        /* caps to build the encoder with in READY */
+  gboolean keep_encoder_on_stop; /* reuse encoder across READY/PAUSED cycles */
 
   GstClockTime last_pts;
   GstClockTime last_dts;
 
   guint32 prev_timestamp;
   gboolean prev_timestamp_valid;
+
+  /* Background encoder rebuild after a live settings change. The streaming
+   * thread swaps the encoder in once rebuild_done is set */
+  GMutex encoder_lock; /* guards encoder swaps against feedback pushes */
+  GThread *rebuild_thread;
+  gint rebuild_done;
+  roc_sender_config rebuild_config;
+  roc_sender_encoder *rebuild_encoder;
+  GstAudioChannelMixer *rebuild_mixer;
+  gint rebuild_channels;
+  gboolean rebuild_rtcp;
+
+  /* Outgoing RTP header rewriting, keeps one continuous stream across
+   * encoders */
+  guint16 seq_offset; /* added to encoder sequence numbers */
+  guint32 ts_offset;  /* added to encoder RTP timestamps */
+  guint32 out_ssrc;   /* SSRC of the first encoder, kept for the stream */
+  gboolean out_ssrc_valid;
+  guint32 enc_ssrc; /* SSRC of the current encoder, under encoder_lock */
+  gboolean enc_ssrc_valid;
+  guint16 last_seq;  /* last sent sequence number */
+  guint32 next_ts;   /* expected timestamp of the next packet */
+  gboolean rebase_pending; /* derive offsets from the next packet */
+  guint32 rebase_ts; /* timestamp the next packet should carry */
+  guint64 frames_pushed;  /* into the current encoder */
+  guint64 frames_emitted; /* out of the current encoder, in packets */
+  /* Packets and payload octets sent on the outgoing stream, and what to add
+   * to the counts in the SRs of the current encoder: DTX-suppressed packets
+   * come off, packets sent by the encoders before it go on */
+  guint32 sent_packets;
+  guint32 sent_octets;
+  guint32 sr_packet_offset;
+  guint32 sr_octet_offset;
+
+  /* Pipeline clock timebase: RTP timestamps count clock time at the stream
+   * rate and SRs carry clock time as NTP time */
+  gboolean use_pipeline_clock; /* property, object lock */
+  gboolean clock_timebase;     /* adopted for the current stream */
+  guint32 sync_rtp_ts;         /* timestamp of the last sent packet */
+  GstClockTime sync_clock_time; /* and the clock time it was captured at */
+
+  /* DTX state */
+  GstClockTime silence_duration;
+  GstClockTime since_keepalive;
+  gboolean talkspurt_start; /* mark next sent packet */
+
+  /* Sent packet history, a power-of-two ring indexed by sequence number,
+   * protected by rtx_lock */
+  GMutex rtx_lock;
+  GstRocSendHistoryEntry *rtx_history;
+  guint rtx_history_len;
+  guint64 rtx_history_bytes;
+  guint16 rtx_oldest_seq; /* oldest sequence number that may be held */
+  guint16 rtx_newest_seq;
+  gboolean rtx_history_valid;
+  guint32 media_ssrc; /* SSRC of the sent RTP stream */
+  gboolean media_ssrc_valid;
+  guint32 rtx_ssrc;
+  guint16 rtx_seq;
+  gboolean rtx_started; /* sticky events sent on rtx_src_pad */
+  guint8 rtx_caps_pt;   /* payload and apt of the caps sent there */
+  guint8 rtx_caps_apt;
+
+  /* Input segment and downstream QoS, for late input handling */
+  GstSegment segment;
+  GstClockTime earliest_time; /* from QoS events, object lock */
+  gdouble proportion;         /* from QoS events, object lock */
+  GstClockTime latency;       /* from LATENCY events, object lock, NONE
+                               * until known */
+
+  /* Capture clock drift compensation: input rate measured against the
+   * pipeline clock, corrected by a variable rate resampler */
+  GstAudioResampler *resampler;
+  gint resampler_channels;
+  gfloat *resample_buf;
+  gsize resample_buf_size; /* in bytes */
+  GstClockTime drift_anchor; /* pipeline clock time the count starts at */
+  guint64 drift_frames;       /* frames since drift_anchor */
+  GstClockTime drift_window_end; /* since drift_anchor */
+  gdouble drift_window_min;      /* least delay in the window, ns */
+  gdouble drift_window_pos;      /* nominal time of that delay, ns */
+  struct {
+    gdouble pos;
+    gdouble delay;
+  } drift_points[DRIFT_POINTS]; /* ring of window minima */
+  guint drift_n_points;
+  guint drift_next_point;
+  gdouble drift_ratio; /* filtered input/nominal rate, 0 until measured */
+  gdouble drift_ppm;   /* object lock */
+
+  /* Feedback handoff: rtcp_sink_chain copies feedback into preallocated
+   * slots and the streaming thread applies it, so only one thread uses the
+   * encoder. Single producer, single consumer, no lock */
+  gboolean feedback_handoff; /* property, object lock */
+  gboolean handoff_active;   /* fixed while streaming */
+  GstRocSendFeedbackSlot *feedback_slots; /* FEEDBACK_QUEUE_SIZE of them */
+  gint feedback_head; /* next slot to apply, atomic */
+  gint feedback_tail; /* next slot to fill, atomic */
+
+  /* Packet capture to pcap, open while streaming */
+  gchar *dump_location;      /* object lock */
+  guint64 dump_rotate_size;  /* object lock */
+  GstRocPcapWriter *dump;    /* atomic, close_dump waits for dump_users */
+  gint dump_users;           /* threads capturing a packet, atomic */
+
+  /* Paced output: the chain queues RTP packets and serialized events, a task
+   * on srcpad releases them spread over the packet durations */
+  gboolean pacing;        /* object lock */
+  guint max_burst;        /* object lock */
+  gboolean pacing_active; /* fixed while srcpad is active */
+  GMutex pace_lock;
+  GCond pace_cond;
+  GstMiniObject *pace_queue[PACING_QUEUE_SIZE]; /* ring, under pace_lock */
+  guint pace_head;
+  guint pace_len;
+  gboolean pace_flushing;
+  GstFlowReturn pace_flow;  /* last downstream result */
+  GstClockID pace_clock_id; /* reused for every wait */
+  GstClockTime pace_time;   /* clock time the queued packets are due by */
+
+  /* Counters, protected by the object lock */
+  guint64 buffers_processed;
+  guint64 buffers_late;
+  GstClockTime late_duration;
+  guint64 packets_sent;
+  guint64 packets_suppressed;
+  guint64 nacks_received;
+  guint64 packets_retransmitted;
+  guint64 retransmissions_missed;
+  guint64 feedback_dropped;
+  guint64 feedback_applied;
 };
 
 G_DEFINE_TYPE(GstRocSend, gst_rocsend, GST_TYPE_ELEMENT)
@@ -86,23 +347,248 @@ static GstStaticPadTemplate rtcp_sink_factory =
     GST_STATIC_PAD_TEMPLATE("rtcp_sink_%u", GST_PAD_SINK, GST_PAD_REQUEST,
                             GST_STATIC_CAPS("application/x-rtcp"));
 
+static GstStaticPadTemplate rtx_src_factory =
+    GST_STATIC_PAD_TEMPLATE("rtx_src_%u", GST_PAD_SRC, GST_PAD_REQUEST,
+                            GST_STATIC_CAPS("application/x-rtp"));
+
 enum {
   PROP_0,
   PROP_PACKET_ENCODING,
   PROP_PACKET_LENGTH,
+  PROP_PREWARM_CAPS,
+  PROP_KEEP_ENCODER_ON_STOP,
+  PROP_MIX_MATRIX,
+  PROP_DOWNMIX,
+  PROP_DTX,
+  PROP_DTX_THRESHOLD,
+  PROP_DTX_HANGOVER,
+  PROP_DTX_KEEPALIVE,
+  PROP_STATS,
+  PROP_RTX_HISTORY_SIZE,
+  PROP_RTX_HISTORY_MAX_BYTES,
+  PROP_RTX_PAYLOAD_TYPE,
+  PROP_MAX_LATENESS,
+  PROP_LATE_POLICY,
+  PROP_DRIFT_COMPENSATION,
+  PROP_DRIFT_PPM,
+  PROP_PACING,
+  PROP_MAX_BURST,
+  PROP_USE_PIPELINE_CLOCK,
+  PROP_DUMP_LOCATION,
+  PROP_DUMP_ROTATE_SIZE,
+  PROP_FEEDBACK_HANDOFF,
 };
 
 static gboolean gst_rocsend_initialize_encoder(GstRocSend *self);
+static gboolean gst_rocsend_configure_from_caps(GstRocSend *self,
+                                                GstCaps *caps);
+static gboolean gst_rocsend_setup_mixer(GstRocSend *self);
+static gboolean gst_rocsend_activate_rtcp(GstRocSend *self);
+static void gst_rocsend_close_encoder(GstRocSend *self);
+static void gst_rocsend_finish_rebuild(GstRocSend *self, gboolean apply);
+static void gst_rocsend_update_settings(GstRocSend *self);
+static void gst_rocsend_history_resize_locked(GstRocSend *self);
+
+/* Number of channels carried by the known ROC packet encodings, 0 if the
+ * encoding is not known to this element */
+static gint gst_rocsend_packet_encoding_channels(guint packet_encoding) {
+  switch (packet_encoding) {
+  case ROC_PACKET_ENCODING_AVP_L16_MONO:
+    return 1;
+  case ROC_PACKET_ENCODING_AVP_L16_STEREO:
+    return 2;
+  default:
+    return 0;
+  }
+}
+
+/* Matrix rows are output channels, columns are input channels, like
+ * audioconvert's mix-matrix */
+static gboolean gst_rocsend_mix_matrix_is_valid(const GValue *value) {
+  const guint rows = gst_value_array_get_size(value);
+  if (rows == 0)
+    return TRUE; /* empty matrix disables explicit mixing */
+
+  const guint cols =
+      gst_value_array_get_size(gst_value_array_get_value(value, 0));
+  if (cols == 0)
+    return FALSE;
+  for (guint i = 1; i < rows; i++) {
+    if (gst_value_array_get_size(gst_value_array_get_value(value, i)) != cols)
+      return FALSE;
+  }
+  return TRUE;
+}
+
+/* Hand a copy of the current settings to the streaming thread, replacing
+ * any copy it has not picked up yet. Call with the object lock held */
+static void gst_rocsend_publish_settings_locked(GstRocSend *self) {
+  GstRocSendSettings *snapshot = g_new(GstRocSendSettings, 1);
+  GstRocSendSettings *old;
+
+  *snapshot = self->settings;
+  do {
+    old = g_atomic_pointer_get(&self->pending_settings);
+  } while (!g_atomic_pointer_compare_and_exchange(&self->pending_settings,
+                                                  old, snapshot));
+  g_free(old);
+}
+
+/* Adopt the latest published settings, if any. Streaming thread only */
+static gboolean gst_rocsend_take_settings(GstRocSend *self) {
+  GstRocSendSettings *snapshot;
+
+  do {
+    snapshot = g_atomic_pointer_get(&self->pending_settings);
+    if (!snapshot)
+      return FALSE;
+  } while (!g_atomic_pointer_compare_and_exchange(&self->pending_settings,
+                                                  snapshot, NULL));
+  self->active = *snapshot;
+  g_free(snapshot);
+  return TRUE;
+}
 
 static void gst_rocsend_set_property(GObject *object, guint prop_id,
                                      const GValue *value, GParamSpec *pspec) {
   GstRocSend *self = GST_ROCSEND(object);
   switch (prop_id) {
   case PROP_PACKET_ENCODING:
-    self->packet_encoding = g_value_get_uint(value);
+    GST_OBJECT_LOCK(self);
+    self->settings.packet_encoding = g_value_get_uint(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
     break;
   case PROP_PACKET_LENGTH:
-    self->packet_length = g_value_get_uint64(value);
+    GST_OBJECT_LOCK(self);
+    self->settings.packet_length = g_value_get_uint64(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_PREWARM_CAPS: {
+    GstCaps *new_caps = g_value_dup_boxed(value);
+    GST_OBJECT_LOCK(self);
+    gst_caps_replace(&self->prewarm_caps, new_caps);
+    GST_OBJECT_UNLOCK(self);
+    if (new_caps)
+      gst_caps_unref(new_caps);
+    break;
+  }
+  case PROP_KEEP_ENCODER_ON_STOP:
+    GST_OBJECT_LOCK(self);
+    self->keep_encoder_on_stop = g_value_get_boolean(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_MIX_MATRIX:
+    if (!gst_rocsend_mix_matrix_is_valid(value)) {
+      g_warning("Ignoring invalid mix-matrix: rows must be non-empty and "
+                "of equal length");
+      break;
+    }
+    GST_OBJECT_LOCK(self);
+    g_value_copy(value, &self->mix_matrix);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DOWNMIX:
+    GST_OBJECT_LOCK(self);
+    self->downmix = g_value_get_boolean(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX:
+    GST_OBJECT_LOCK(self);
+    self->settings.dtx = g_value_get_boolean(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_THRESHOLD:
+    GST_OBJECT_LOCK(self);
+    self->settings.dtx_threshold = g_value_get_double(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_HANGOVER:
+    GST_OBJECT_LOCK(self);
+    self->settings.dtx_hangover = g_value_get_uint64(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_KEEPALIVE:
+    GST_OBJECT_LOCK(self);
+    self->settings.dtx_keepalive = g_value_get_uint64(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_RTX_HISTORY_SIZE:
+    g_mutex_lock(&self->rtx_lock);
+    self->rtx_history_size = g_value_get_uint(value);
+    gst_rocsend_history_resize_locked(self);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_RTX_HISTORY_MAX_BYTES:
+    g_mutex_lock(&self->rtx_lock);
+    self->rtx_history_max_bytes = g_value_get_uint64(value);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_RTX_PAYLOAD_TYPE:
+    g_mutex_lock(&self->rtx_lock);
+    self->rtx_payload_type = g_value_get_uint(value);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_MAX_LATENESS:
+    GST_OBJECT_LOCK(self);
+    self->settings.max_lateness = g_value_get_int64(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_LATE_POLICY:
+    GST_OBJECT_LOCK(self);
+    self->settings.late_policy = g_value_get_enum(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DRIFT_COMPENSATION:
+    GST_OBJECT_LOCK(self);
+    self->settings.drift_compensation = g_value_get_boolean(value);
+    gst_rocsend_publish_settings_locked(self);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_PACING:
+    GST_OBJECT_LOCK(self);
+    /* The src pad has been activated with the current value */
+    if (GST_STATE(self) > GST_STATE_READY ||
+        GST_STATE_NEXT(self) > GST_STATE_READY) {
+      GST_OBJECT_UNLOCK(self);
+      GST_WARNING_OBJECT(self, "pacing can only be changed in NULL or READY");
+      break;
+    }
+    self->pacing = g_value_get_boolean(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_MAX_BURST:
+    GST_OBJECT_LOCK(self);
+    self->max_burst = g_value_get_uint(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_USE_PIPELINE_CLOCK:
+    GST_OBJECT_LOCK(self);
+    self->use_pipeline_clock = g_value_get_boolean(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DUMP_LOCATION:
+    GST_OBJECT_LOCK(self);
+    g_free(self->dump_location);
+    self->dump_location = g_value_dup_string(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DUMP_ROTATE_SIZE:
+    GST_OBJECT_LOCK(self);
+    self->dump_rotate_size = g_value_get_uint64(value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_FEEDBACK_HANDOFF:
+    GST_OBJECT_LOCK(self);
+    self->feedback_handoff = g_value_get_boolean(value);
+    GST_OBJECT_UNLOCK(self);
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -110,13 +596,141 @@ static void gst_rocsend_set_property(GObject *object, guint prop_id,
   }
 }
 
+static GstStructure *gst_rocsend_create_stats(GstRocSend *self) {
+  GstStructure *s;
+
+  GST_OBJECT_LOCK(self);
+  s = gst_structure_new("application/x-rocsend-stats", "packets-sent",
+                        G_TYPE_UINT64, self->packets_sent,
+                        "packets-suppressed", G_TYPE_UINT64,
+                        self->packets_suppressed, "nacks-received",
+                        G_TYPE_UINT64, self->nacks_received,
+                        "packets-retransmitted", G_TYPE_UINT64,
+                        self->packets_retransmitted, "retransmissions-missed",
+                        G_TYPE_UINT64, self->retransmissions_missed,
+                        "buffers-late", G_TYPE_UINT64, self->buffers_late,
+                        "late-duration", G_TYPE_UINT64, self->late_duration,
+                        "feedback-dropped", G_TYPE_UINT64,
+                        self->feedback_dropped, "feedback-applied",
+                        G_TYPE_UINT64, self->feedback_applied, NULL);
+  GST_OBJECT_UNLOCK(self);
+  return s;
+}
+
+/* Drop every packet held for retransmission. Call with rtx_lock held */
+static void gst_rocsend_history_clear_locked(GstRocSend *self) {
+  for (guint i = 0; i < self->rtx_history_len; i++)
+    gst_clear_buffer(&self->rtx_history[i].buffer);
+  g_free(self->rtx_history);
+  self->rtx_history = NULL;
+  self->rtx_history_len = 0;
+  self->rtx_history_bytes = 0;
+  self->rtx_history_valid = FALSE;
+}
+
+/* Allocate the ring for rtx-history-size, up front so that adding packets
+ * never allocates. Call with rtx_lock held */
+static void gst_rocsend_history_resize_locked(GstRocSend *self) {
+  /* The ring is a power of two so that slots stay consistent across
+   * sequence number wraparound */
+  const guint capacity =
+      self->rtx_history_size ? 1u << g_bit_storage(self->rtx_history_size - 1)
+                             : 0;
+  if (capacity == self->rtx_history_len)
+    return;
+
+  gst_rocsend_history_clear_locked(self);
+  if (capacity > 0) {
+    self->rtx_history = g_new0(GstRocSendHistoryEntry, capacity);
+    self->rtx_history_len = capacity;
+  }
+}
+
+static void gst_rocsend_history_evict_locked(GstRocSend *self,
+                                             GstRocSendHistoryEntry *entry) {
+  self->rtx_history_bytes -= gst_buffer_get_size(entry->buffer);
+  gst_clear_buffer(&entry->buffer);
+}
+
+/* Evict the oldest held packet. Call with rtx_lock held */
+static void gst_rocsend_history_pop_oldest_locked(GstRocSend *self) {
+  GstRocSendHistoryEntry *oldest =
+      &self->rtx_history[self->rtx_oldest_seq & (self->rtx_history_len - 1)];
+  if (oldest->buffer && oldest->seq == self->rtx_oldest_seq)
+    gst_rocsend_history_evict_locked(self, oldest);
+  self->rtx_oldest_seq++;
+}
+
+/* Keep a ref to a packet of stream @ssrc about to be pushed, evicting the
+ * oldest packets to stay within the configured depth and byte cap */
+static void gst_rocsend_history_add(GstRocSend *self, guint16 seq,
+                                    guint32 ssrc, GstBuffer *buffer) {
+  g_mutex_lock(&self->rtx_lock);
+  if (self->rtx_history_len == 0)
+    goto done;
+
+  self->media_ssrc = ssrc;
+  self->media_ssrc_valid = TRUE;
+
+  /* A sequence jump (new encoder, reordering) invalidates the window */
+  if (self->rtx_history_valid &&
+      (guint16)(seq - self->rtx_newest_seq) != 1) {
+    for (guint i = 0; i < self->rtx_history_len; i++) {
+      if (self->rtx_history[i].buffer)
+        gst_rocsend_history_evict_locked(self, &self->rtx_history[i]);
+    }
+    self->rtx_history_valid = FALSE;
+  }
+  if (!self->rtx_history_valid) {
+    self->rtx_oldest_seq = seq;
+    self->rtx_history_valid = TRUE;
+  }
+
+  while ((guint16)(seq - self->rtx_oldest_seq) >= self->rtx_history_size)
+    gst_rocsend_history_pop_oldest_locked(self);
+
+  GstRocSendHistoryEntry *entry =
+      &self->rtx_history[seq & (self->rtx_history_len - 1)];
+  entry->seq = seq;
+  entry->buffer = gst_buffer_ref(buffer);
+  self->rtx_history_bytes += gst_buffer_get_size(buffer);
+  self->rtx_newest_seq = seq;
+
+  while (self->rtx_history_max_bytes > 0 &&
+         self->rtx_history_bytes > self->rtx_history_max_bytes &&
+         self->rtx_oldest_seq != seq)
+    gst_rocsend_history_pop_oldest_locked(self);
+
+done:
+  g_mutex_unlock(&self->rtx_lock);
+}
+
+/* Returns a ref to the packet with @seq if it is still held */
+static GstBuffer *gst_rocsend_history_lookup(GstRocSend *self, guint16 seq) {
+  GstBuffer *buffer = NULL;
+
+  g_mutex_lock(&self->rtx_lock);
+  if (self->rtx_history_len > 0 && self->rtx_history_valid) {
+    GstRocSendHistoryEntry *entry =
+        &self->rtx_history[seq & (self->rtx_history_len - 1)];
+    if (entry->buffer && entry->seq == seq)
+      buffer = gst_buffer_ref(entry->buffer);
+  }
+  g_mutex_unlock(&self->rtx_lock);
+  return buffer;
+}
+
 static void gst_rocsend_finalize(GObject *object) {
   GstRocSend *self = GST_ROCSEND(object);
 
-  if (self->encoder) {
-    roc_sender_encoder_close(self->encoder);
-    self->encoder = NULL;
-  }
+  g_mutex_lock(&self->rtx_lock);
+  gst_rocsend_history_clear_locked(self);
+  g_mutex_unlock(&self->rtx_lock);
+  g_mutex_clear(&self->rtx_lock);
+
+  gst_rocsend_close_encoder(self);
+  g_mutex_clear(&self->encoder_lock);
+  g_free(self->pending_settings);
 
   if (self->context) {
     roc_context_close(self->context);
@@ -128,6 +742,25 @@ static void gst_rocsend_finalize(GObject *object) {
     self->negotiated_caps = NULL;
   }
 
+  gst_caps_replace(&self->prewarm_caps, NULL);
+  g_free(self->dump_location);
+  g_free(self->feedback_slots);
+  gst_object_unref(self->packet_pool);
+  if (self->resampler)
+    gst_audio_resampler_free(self->resampler);
+  g_free(self->resample_buf);
+  g_free(self->frame_buf);
+  self->frame_buf = NULL;
+  if (self->mixer) {
+    gst_audio_channel_mixer_free(self->mixer);
+    self->mixer = NULL;
+  }
+  g_value_unset(&self->mix_matrix);
+  if (self->pace_clock_id)
+    gst_clock_id_unref(self->pace_clock_id);
+  g_mutex_clear(&self->pace_lock);
+  g_cond_clear(&self->pace_cond);
+
   G_OBJECT_CLASS(gst_rocsend_parent_class)->finalize(object);
 }
 
@@ -136,10 +769,122 @@ static void gst_rocsend_get_property(GObject *object, guint prop_id,
   GstRocSend *self = GST_ROCSEND(object);
   switch (prop_id) {
   case PROP_PACKET_ENCODING:
-    g_value_set_uint(value, self->packet_encoding);
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint(value, self->settings.packet_encoding);
+    GST_OBJECT_UNLOCK(self);
     break;
   case PROP_PACKET_LENGTH:
-    g_value_set_uint64(value, self->packet_length);
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint64(value, self->settings.packet_length);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_PREWARM_CAPS:
+    GST_OBJECT_LOCK(self);
+    gst_value_set_caps(value, self->prewarm_caps);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_KEEP_ENCODER_ON_STOP:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->keep_encoder_on_stop);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_MIX_MATRIX:
+    GST_OBJECT_LOCK(self);
+    g_value_copy(&self->mix_matrix, value);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DOWNMIX:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->downmix);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->settings.dtx);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_THRESHOLD:
+    GST_OBJECT_LOCK(self);
+    g_value_set_double(value, self->settings.dtx_threshold);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_HANGOVER:
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint64(value, self->settings.dtx_hangover);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DTX_KEEPALIVE:
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint64(value, self->settings.dtx_keepalive);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_STATS:
+    g_value_take_boxed(value, gst_rocsend_create_stats(self));
+    break;
+  case PROP_RTX_HISTORY_SIZE:
+    g_mutex_lock(&self->rtx_lock);
+    g_value_set_uint(value, self->rtx_history_size);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_RTX_HISTORY_MAX_BYTES:
+    g_mutex_lock(&self->rtx_lock);
+    g_value_set_uint64(value, self->rtx_history_max_bytes);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_RTX_PAYLOAD_TYPE:
+    g_mutex_lock(&self->rtx_lock);
+    g_value_set_uint(value, self->rtx_payload_type);
+    g_mutex_unlock(&self->rtx_lock);
+    break;
+  case PROP_MAX_LATENESS:
+    GST_OBJECT_LOCK(self);
+    g_value_set_int64(value, self->settings.max_lateness);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_LATE_POLICY:
+    GST_OBJECT_LOCK(self);
+    g_value_set_enum(value, self->settings.late_policy);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DRIFT_COMPENSATION:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->settings.drift_compensation);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DRIFT_PPM:
+    GST_OBJECT_LOCK(self);
+    g_value_set_double(value, self->drift_ppm);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_PACING:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->pacing);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_MAX_BURST:
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint(value, self->max_burst);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_USE_PIPELINE_CLOCK:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->use_pipeline_clock);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DUMP_LOCATION:
+    GST_OBJECT_LOCK(self);
+    g_value_set_string(value, self->dump_location);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_DUMP_ROTATE_SIZE:
+    GST_OBJECT_LOCK(self);
+    g_value_set_uint64(value, self->dump_rotate_size);
+    GST_OBJECT_UNLOCK(self);
+    break;
+  case PROP_FEEDBACK_HANDOFF:
+    GST_OBJECT_LOCK(self);
+    g_value_set_boolean(value, self->feedback_handoff);
+    GST_OBJECT_UNLOCK(self);
     break;
   default:
     G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -147,6 +892,231 @@ static void gst_rocsend_get_property(GObject *object, guint prop_id,
   }
 }
 
+static void gst_rocsend_reset_qos(GstRocSend *self) {
+  GST_OBJECT_LOCK(self);
+  self->earliest_time = GST_CLOCK_TIME_NONE;
+  self->proportion = 1.0;
+  GST_OBJECT_UNLOCK(self);
+}
+
+/* Downstream QoS tells how late our packets arrive. Like basetransform,
+ * remember the earliest running time worth producing. The LATENCY event
+ * tells how far behind the clock live input may arrive */
+static gboolean gst_rocsend_src_event(GstPad *pad, GstObject *parent,
+                                      GstEvent *event) {
+  GstRocSend *self = GST_ROCSEND(parent);
+
+  if (GST_EVENT_TYPE(event) == GST_EVENT_LATENCY) {
+    GstClockTime latency;
+
+    gst_event_parse_latency(event, &latency);
+    GST_OBJECT_LOCK(self);
+    self->latency = latency;
+    GST_OBJECT_UNLOCK(self);
+    GST_DEBUG_OBJECT(self, "Pipeline latency %" GST_TIME_FORMAT,
+                     GST_TIME_ARGS(latency));
+  } else if (GST_EVENT_TYPE(event) == GST_EVENT_QOS) {
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+
+    gst_event_parse_qos(event, &type, &proportion, &diff, &timestamp);
+    GST_OBJECT_LOCK(self);
+    self->proportion = proportion;
+    if (GST_CLOCK_TIME_IS_VALID(timestamp)) {
+      /* Late packets are skipped over twice as far to catch up */
+      if (diff > 0)
+        self->earliest_time = timestamp + 2 * diff;
+      else
+        self->earliest_time = timestamp + diff;
+    } else {
+      self->earliest_time = GST_CLOCK_TIME_NONE;
+    }
+    GST_OBJECT_UNLOCK(self);
+    GST_LOG_OBJECT(self,
+                   "QoS: proportion %.3f, diff %" GST_STIME_FORMAT
+                   ", timestamp %" GST_TIME_FORMAT,
+                   proportion, GST_STIME_ARGS(diff), GST_TIME_ARGS(timestamp));
+  }
+  return gst_pad_event_default(pad, parent, event);
+}
+
+/* Queue a packet or serialized event for the pacing task, waiting while the
+ * queue is full. Takes ownership of obj */
+static GstFlowReturn gst_rocsend_pace_enqueue(GstRocSend *self,
+                                              GstMiniObject *obj) {
+  const gboolean is_buffer = GST_IS_BUFFER(obj);
+  GstFlowReturn ret;
+
+  g_mutex_lock(&self->pace_lock);
+  while (!self->pace_flushing && self->pace_len == PACING_QUEUE_SIZE &&
+         (!is_buffer || self->pace_flow == GST_FLOW_OK))
+    g_cond_wait(&self->pace_cond, &self->pace_lock);
+  if (self->pace_flushing)
+    ret = GST_FLOW_FLUSHING;
+  else
+    ret = is_buffer ? self->pace_flow : GST_FLOW_OK;
+  if (ret == GST_FLOW_OK) {
+    self->pace_queue[(self->pace_head + self->pace_len) % PACING_QUEUE_SIZE] =
+        obj;
+    self->pace_len++;
+    g_cond_broadcast(&self->pace_cond);
+  }
+  g_mutex_unlock(&self->pace_lock);
+
+  if (ret != GST_FLOW_OK)
+    gst_mini_object_unref(obj);
+  return ret;
+}
+
+/* Drop everything queued and wake up the task and a blocked chain */
+static void gst_rocsend_pace_flush(GstRocSend *self, gboolean flushing) {
+  g_mutex_lock(&self->pace_lock);
+  self->pace_flushing = flushing;
+  while (self->pace_len > 0) {
+    gst_mini_object_unref(self->pace_queue[self->pace_head]);
+    self->pace_queue[self->pace_head] = NULL;
+    self->pace_head = (self->pace_head + 1) % PACING_QUEUE_SIZE;
+    self->pace_len--;
+  }
+  self->pace_head = 0;
+  self->pace_flow = GST_FLOW_OK;
+  self->pace_time = GST_CLOCK_TIME_NONE;
+  if (flushing && self->pace_clock_id)
+    gst_clock_id_unschedule(self->pace_clock_id);
+  g_cond_broadcast(&self->pace_cond);
+  g_mutex_unlock(&self->pace_lock);
+}
+
+/* Hold a packet of the given duration until it is due. Packets leave one
+ * duration apart, with up to max-burst of them at once after idle time.
+ * Call with pace_lock held, returns FALSE when woken up by a flush */
+static gboolean gst_rocsend_pace_wait(GstRocSend *self,
+                                      GstClockTime duration) {
+  GstClock *clock = NULL;
+
+  GST_OBJECT_LOCK(self);
+  if (GST_STATE(self) == GST_STATE_PLAYING && GST_ELEMENT_CLOCK(self))
+    clock = gst_object_ref(GST_ELEMENT_CLOCK(self));
+  const guint max_burst = MAX(1, self->max_burst);
+  GST_OBJECT_UNLOCK(self);
+
+  /* Not running against a clock, e.g. prerolling: nothing to pace to */
+  if (!clock) {
+    self->pace_time = GST_CLOCK_TIME_NONE;
+    return TRUE;
+  }
+
+  if (!GST_CLOCK_TIME_IS_VALID(duration))
+    duration = 0;
+  const GstClockTime now = gst_clock_get_time(clock);
+  const GstClockTime burst = (max_burst - 1) * duration;
+  if (!GST_CLOCK_TIME_IS_VALID(self->pace_time) || self->pace_time < now)
+    self->pace_time = now;
+
+  gboolean res = TRUE;
+  if (self->pace_time > now + burst) {
+    const GstClockTime due = self->pace_time - burst;
+    if (!self->pace_clock_id ||
+        !gst_clock_single_shot_id_reinit(clock, self->pace_clock_id, due)) {
+      if (self->pace_clock_id)
+        gst_clock_id_unref(self->pace_clock_id);
+      self->pace_clock_id = gst_clock_new_single_shot_id(clock, due);
+    }
+    GstClockID id = gst_clock_id_ref(self->pace_clock_id);
+
+    GST_TRACE_OBJECT(self, "Holding packet until %" GST_TIME_FORMAT,
+                     GST_TIME_ARGS(due));
+    g_mutex_unlock(&self->pace_lock);
+    gst_clock_id_wait(id, NULL);
+    gst_clock_id_unref(id);
+    g_mutex_lock(&self->pace_lock);
+    res = !self->pace_flushing;
+  }
+  if (res)
+    self->pace_time += duration;
+  gst_object_unref(clock);
+  return res;
+}
+
+static void gst_rocsend_pace_loop(gpointer user_data) {
+  GstRocSend *self = GST_ROCSEND(user_data);
+
+  g_mutex_lock(&self->pace_lock);
+  while (!self->pace_flushing && self->pace_len == 0)
+    g_cond_wait(&self->pace_cond, &self->pace_lock);
+  if (self->pace_flushing)
+    goto flushing;
+
+  GstMiniObject *obj = self->pace_queue[self->pace_head];
+  if (GST_IS_BUFFER(obj) &&
+      !gst_rocsend_pace_wait(self, GST_BUFFER_DURATION(obj)))
+    goto flushing;
+
+  self->pace_queue[self->pace_head] = NULL;
+  self->pace_head = (self->pace_head + 1) % PACING_QUEUE_SIZE;
+  self->pace_len--;
+  g_cond_broadcast(&self->pace_cond);
+  g_mutex_unlock(&self->pace_lock);
+
+  if (GST_IS_BUFFER(obj)) {
+    const GstFlowReturn ret = gst_pad_push(self->srcpad, GST_BUFFER_CAST(obj));
+    if (ret != GST_FLOW_OK) {
+      GST_DEBUG_OBJECT(self, "Paced push returned %s", gst_flow_get_name(ret));
+      /* Handed back to upstream from the next chain call */
+      g_mutex_lock(&self->pace_lock);
+      if (self->pace_flow == GST_FLOW_OK)
+        self->pace_flow = ret;
+      g_cond_broadcast(&self->pace_cond);
+      g_mutex_unlock(&self->pace_lock);
+    }
+  } else {
+    gst_pad_push_event(self->srcpad, GST_EVENT_CAST(obj));
+  }
+  return;
+
+flushing:
+  g_mutex_unlock(&self->pace_lock);
+  GST_DEBUG_OBJECT(self, "Pausing pacing task");
+  gst_pad_pause_task(self->srcpad);
+}
+
+/* The pacing task runs while srcpad is active, if pacing is enabled */
+static gboolean gst_rocsend_src_activate_mode(GstPad *pad, GstObject *parent,
+                                              GstPadMode mode,
+                                              gboolean active) {
+  GstRocSend *self = GST_ROCSEND(parent);
+
+  if (mode != GST_PAD_MODE_PUSH)
+    return FALSE;
+
+  if (active) {
+    GST_OBJECT_LOCK(self);
+    self->pacing_active = self->pacing;
+    GST_OBJECT_UNLOCK(self);
+    if (!self->pacing_active)
+      return TRUE;
+    gst_rocsend_pace_flush(self, FALSE);
+    return gst_pad_start_task(pad, gst_rocsend_pace_loop, self, NULL);
+  }
+
+  if (!self->pacing_active)
+    return TRUE;
+  /* Stays flushing, so a chain still running refuses to queue more */
+  gst_rocsend_pace_flush(self, TRUE);
+  return gst_pad_stop_task(pad);
+}
+
+/* Push a serialized event in order with the packets queued for pacing */
+static gboolean gst_rocsend_push_src_event(GstRocSend *self,
+                                           GstEvent *event) {
+  if (self->pacing_active && GST_EVENT_IS_SERIALIZED(event))
+    return gst_rocsend_pace_enqueue(self, GST_MINI_OBJECT_CAST(event)) ==
+           GST_FLOW_OK;
+  return gst_pad_push_event(self->srcpad, event);
+}
+
 static gboolean gst_rocsend_sink_event(GstPad *pad, GstObject *parent,
                                        GstEvent *event) {
   GstRocSend *self = GST_ROCSEND(parent);
@@ -158,48 +1128,35 @@ static gboolean gst_rocsend_sink_event(GstPad *pad, GstObject *parent,
     GstCaps *caps;
     gst_event_parse_caps(event, &caps);
     GST_LOG_OBJECT(self, "Processing CAPS event");
-    if (self->negotiated_caps)
+
+    /* A prewarmed or kept encoder can be reused as long as the caps describe
+     * the same audio as the ones it was built for */
+    GstAudioInfo info, built_info;
+    if (self->encoder && self->negotiated_caps &&
+        gst_audio_info_from_caps(&info, caps) &&
+        gst_audio_info_from_caps(&built_info, self->negotiated_caps) &&
+        gst_audio_info_is_equal(&info, &built_info)) {
+      GST_INFO_OBJECT(self, "Reusing ROC encoder built for matching caps");
       gst_caps_unref(self->negotiated_caps);
-    self->negotiated_caps = gst_caps_copy(caps);
-
-    // Parse caps to get audio format
-    GstStructure *s = gst_caps_get_structure(caps, 0);
-    const gchar *format = gst_structure_get_string(s, "format");
-    gint rate = 0, channels = 0;
-    gst_structure_get_int(s, "rate", &rate);
-    gst_structure_get_int(s, "channels", &channels);
-
-    // Store configuration for deferred initialization
-    self->config_state.rate = rate;
-    self->config_state.channels = channels;
-
-    if (channels == 1)
-      self->config_state.channel_layout = ROC_CHANNEL_LAYOUT_MONO;
-    else if (channels == 2)
-      self->config_state.channel_layout = ROC_CHANNEL_LAYOUT_STEREO;
-    else {
-      self->config_state.channel_layout = ROC_CHANNEL_LAYOUT_MULTITRACK;
-      self->config_state.tracks = channels;
-    }
-
-    if (g_strcmp0(format, "F32LE") == 0) {
-      self->config_state.format = ROC_FORMAT_PCM;
-      self->config_state.subformat = ROC_SUBFORMAT_PCM_FLOAT32_LE;
+      self->negotiated_caps = gst_caps_copy(caps);
+
+      /* mix-matrix and downmix may have changed since, the encoder only
+       * has to go if the frames it gets change width */
+      const gint frame_channels = self->frame_channels;
+      if (!gst_rocsend_setup_mixer(self) ||
+          (self->frame_channels != frame_channels &&
+           !gst_rocsend_initialize_encoder(self))) {
+        GST_ERROR_OBJECT(self, "Failed to set up channel mixing");
+        gst_event_unref(event);
+        return FALSE;
+      }
     } else {
-      GST_ERROR_OBJECT(
-          self, "Unsupported format for ROC encoder: %s (only F32LE supported)",
-          format);
-      gst_event_unref(event);
-      return FALSE;
-    }
-
-    self->config_state.caps_negotiated = TRUE;
-    GST_INFO_OBJECT(
-        self, "Stored caps configuration: channels=%d, format=%s, rate=%d",
-        channels, format, rate);
+      if (!gst_rocsend_configure_from_caps(self, caps)) {
+        gst_event_unref(event);
+        return FALSE;
+      }
 
-    // Initialize ROC encoder now that we have caps
-    if (!self->encoder) {
+      // Initialize ROC encoder now that we have caps
       GST_INFO_OBJECT(self, "Initializing ROC encoder on CAPS event");
       if (!gst_rocsend_initialize_encoder(self)) {
         GST_ERROR_OBJECT(self, "Failed to initialize ROC encoder");
@@ -211,9 +1168,11 @@ static gboolean gst_rocsend_sink_event(GstPad *pad, GstObject *parent,
     // Create and set caps on source pad
     GstCaps *src_caps = gst_caps_new_simple(
         "application/x-rtp", "media", G_TYPE_STRING, "audio", "clock-rate",
-        G_TYPE_INT, rate, "encoding-name", G_TYPE_STRING, "F32LE", NULL);
+        G_TYPE_INT, self->config_state.rate, "encoding-name", G_TYPE_STRING,
+        "F32LE", NULL);
 
-    gboolean caps_set = gst_pad_set_caps(self->srcpad, src_caps);
+    gboolean caps_set =
+        gst_rocsend_push_src_event(self, gst_event_new_caps(src_caps));
     gst_caps_unref(src_caps);
 
     if (!caps_set) {
@@ -227,16 +1186,716 @@ static gboolean gst_rocsend_sink_event(GstPad *pad, GstObject *parent,
   }
   case GST_EVENT_EOS:
     GST_INFO_OBJECT(self, "Received EOS event");
+    res = gst_rocsend_push_src_event(self, event);
+    break;
+  case GST_EVENT_SEGMENT:
+    gst_event_copy_segment(event, &self->segment);
+    GST_DEBUG_OBJECT(self, "Input segment %" GST_SEGMENT_FORMAT,
+                     &self->segment);
+    res = gst_rocsend_push_src_event(self, event);
+    break;
+  case GST_EVENT_FLUSH_START:
     res = gst_pad_push_event(self->srcpad, event);
+    if (self->pacing_active) {
+      gst_rocsend_pace_flush(self, TRUE);
+      gst_pad_pause_task(self->srcpad);
+    }
+    break;
+  case GST_EVENT_FLUSH_STOP:
+    gst_segment_init(&self->segment, GST_FORMAT_UNDEFINED);
+    gst_rocsend_reset_qos(self);
+    self->drift_anchor = GST_CLOCK_TIME_NONE;
+    res = gst_pad_push_event(self->srcpad, event);
+    if (self->pacing_active) {
+      gst_rocsend_pace_flush(self, FALSE);
+      gst_pad_start_task(self->srcpad, gst_rocsend_pace_loop, self, NULL);
+    }
     break;
   default:
     GST_LOG_OBJECT(self, "Passing event to default handler");
-    res = gst_pad_push_event(self->srcpad, event);
+    res = gst_rocsend_push_src_event(self, event);
     break;
   }
   return res;
 }
 
+/* Propose a pool of aligned input buffers holding whole ROC packets */
+static gboolean gst_rocsend_propose_allocation(GstRocSend *self,
+                                               GstQuery *query) {
+  GstCaps *caps;
+  gboolean need_pool;
+  GstAudioInfo info;
+
+  gst_query_parse_allocation(query, &caps, &need_pool);
+  if (!caps || !gst_audio_info_from_caps(&info, caps)) {
+    GST_DEBUG_OBJECT(self, "Can't propose allocation without audio caps");
+    return FALSE;
+  }
+
+  GST_OBJECT_LOCK(self);
+  const GstClockTime packet_length = self->settings.packet_length
+                                         ? self->settings.packet_length
+                                         : DEFAULT_PACKET_LENGTH;
+  GST_OBJECT_UNLOCK(self);
+  const guint64 packet_samples = MAX(
+      1, gst_util_uint64_scale_int(packet_length, GST_AUDIO_INFO_RATE(&info),
+                                   GST_SECOND));
+  const guint64 packets =
+      MAX(1, (ALLOCATION_BUFFER_DURATION + packet_length - 1) / packet_length);
+  const guint size = packets * packet_samples * GST_AUDIO_INFO_BPF(&info);
+
+  GstAllocationParams params;
+  gst_allocation_params_init(&params);
+  params.align = ALLOCATION_ALIGN;
+
+  if (need_pool) {
+    GstBufferPool *pool = gst_buffer_pool_new();
+    GstStructure *config = gst_buffer_pool_get_config(pool);
+    gst_buffer_pool_config_set_params(config, caps, size, 0, 0);
+    gst_buffer_pool_config_set_allocator(config, NULL, &params);
+    if (!gst_buffer_pool_set_config(pool, config)) {
+      GST_WARNING_OBJECT(self, "Failed to configure proposed buffer pool");
+      gst_object_unref(pool);
+      return FALSE;
+    }
+    gst_query_add_allocation_pool(query, pool, size, 0, 0);
+    gst_object_unref(pool);
+  }
+  gst_query_add_allocation_param(query, NULL, &params);
+  gst_query_add_allocation_meta(query, GST_AUDIO_META_API_TYPE, NULL);
+
+  GST_DEBUG_OBJECT(self,
+                   "Proposed %u byte buffers (%" G_GUINT64_FORMAT
+                   " packets of %" G_GUINT64_FORMAT " samples)",
+                   size, packets, packet_samples);
+  return TRUE;
+}
+
+static gboolean gst_rocsend_sink_query(GstPad *pad, GstObject *parent,
+                                       GstQuery *query) {
+  GstRocSend *self = GST_ROCSEND(parent);
+
+  switch (GST_QUERY_TYPE(query)) {
+  case GST_QUERY_ALLOCATION:
+    return gst_rocsend_propose_allocation(self, query);
+  default:
+    return gst_pad_query_default(pad, parent, query);
+  }
+}
+
+/* Track how long the input has been silent, for DTX */
+static void gst_rocsend_dtx_update(GstRocSend *self, const roc_frame *frame) {
+  const gsize n_samples = frame->samples_size / sizeof(gfloat);
+  const GstClockTime duration = gst_util_uint64_scale_int(
+      n_samples / MAX(1, self->frame_channels), GST_SECOND,
+      MAX(1, self->config_state.rate));
+  const gfloat threshold = pow(10.0, self->active.dtx_threshold / 20.0);
+
+  if (gst_roc_peak_f32(frame->samples, n_samples) < threshold) {
+    self->silence_duration += duration;
+  } else {
+    if (self->silence_duration > self->active.dtx_hangover) {
+      GST_DEBUG_OBJECT(self, "Talkspurt after %" GST_TIME_FORMAT " silence",
+                       GST_TIME_ARGS(self->silence_duration));
+      self->talkspurt_start = TRUE;
+    }
+    self->silence_duration = 0;
+  }
+}
+
+/* Decide whether a popped packet goes on the wire. While suppressing, only
+ * one keepalive per dtx-keepalive interval is sent */
+static gboolean gst_rocsend_dtx_keep_packet(GstRocSend *self,
+                                            GstClockTime duration) {
+  if (!self->active.dtx ||
+      self->silence_duration <= self->active.dtx_hangover) {
+    self->since_keepalive = 0;
+    return TRUE;
+  }
+
+  self->since_keepalive += duration;
+  if (self->since_keepalive >= self->active.dtx_keepalive) {
+    self->since_keepalive = 0;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* Pipeline clock time the input at @pts was captured at, or
+ * GST_CLOCK_TIME_NONE if it can't be told */
+static GstClockTime gst_rocsend_capture_clock_time(GstRocSend *self,
+                                                   GstClockTime pts) {
+  if (!GST_CLOCK_TIME_IS_VALID(pts) || self->segment.format != GST_FORMAT_TIME)
+    return GST_CLOCK_TIME_NONE;
+  const GstClockTime running_time =
+      gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts);
+  if (!GST_CLOCK_TIME_IS_VALID(running_time))
+    return GST_CLOCK_TIME_NONE;
+  return gst_element_get_base_time(GST_ELEMENT(self)) + running_time;
+}
+
+/* Map an encoder's sequence numbers, timestamps and SSRC onto the outgoing
+ * stream. Every popped packet passes here, @keep says if it is sent */
+static void gst_rocsend_rewrite_rtp(GstRocSend *self, GstRTPBuffer *rtp,
+                                    GstClockTime pts, guint32 samples,
+                                    gboolean keep) {
+  const guint32 ssrc = gst_rtp_buffer_get_ssrc(rtp);
+  const guint16 seq = gst_rtp_buffer_get_seq(rtp);
+  const guint32 timestamp = gst_rtp_buffer_get_timestamp(rtp);
+  gboolean new_stream = FALSE;
+
+  if (G_UNLIKELY(!self->enc_ssrc_valid)) {
+    g_mutex_lock(&self->encoder_lock);
+    self->enc_ssrc = ssrc;
+    self->enc_ssrc_valid = TRUE;
+    if (!self->out_ssrc_valid) {
+      self->out_ssrc = ssrc;
+      self->out_ssrc_valid = TRUE;
+      new_stream = TRUE;
+    }
+    g_mutex_unlock(&self->encoder_lock);
+  }
+  if (G_UNLIKELY(new_stream)) {
+    GST_OBJECT_LOCK(self);
+    self->clock_timebase = self->use_pipeline_clock;
+    GST_OBJECT_UNLOCK(self);
+    self->sync_clock_time = GST_CLOCK_TIME_NONE;
+  }
+  if (G_UNLIKELY(new_stream && self->clock_timebase)) {
+    /* Start the timestamps at the capture clock time, from there on they
+     * advance with the samples like any other stream */
+    const GstClockTime clock_time = gst_rocsend_capture_clock_time(self, pts);
+    if (GST_CLOCK_TIME_IS_VALID(clock_time)) {
+      self->ts_offset = (guint32)gst_util_uint64_scale_int(
+                            clock_time, self->config_state.rate, GST_SECOND) -
+                        timestamp;
+      GST_DEBUG_OBJECT(self,
+                       "Stream timestamps start at clock time %" GST_TIME_FORMAT,
+                       GST_TIME_ARGS(clock_time));
+    } else {
+      GST_WARNING_OBJECT(self, "No capture time for the first packet, RTP "
+                               "timestamps are not tied to the clock");
+    }
+  }
+  if (G_UNLIKELY(self->rebase_pending)) {
+    self->seq_offset = (guint16)(self->last_seq + 1 - seq);
+    self->ts_offset = self->rebase_ts - timestamp;
+    self->rebase_pending = FALSE;
+    GST_DEBUG_OBJECT(self, "Continuing stream at #%u, timestamp %u",
+                     (guint16)(self->last_seq + 1), self->rebase_ts);
+  }
+
+  self->next_ts = timestamp + self->ts_offset + samples;
+  if (!keep)
+    return;
+
+  /* Suppressed packets leave no gap in sequence numbers, so receivers see a
+   * timestamp jump (silence) rather than loss */
+  self->last_seq = seq + self->seq_offset;
+  gst_rtp_buffer_set_seq(rtp, self->last_seq);
+  if (self->ts_offset != 0)
+    gst_rtp_buffer_set_timestamp(rtp, timestamp + self->ts_offset);
+  if (ssrc != self->out_ssrc)
+    gst_rtp_buffer_set_ssrc(rtp, self->out_ssrc);
+
+  if (self->clock_timebase) {
+    const GstClockTime clock_time = gst_rocsend_capture_clock_time(self, pts);
+    if (GST_CLOCK_TIME_IS_VALID(clock_time)) {
+      self->sync_rtp_ts = timestamp + self->ts_offset;
+      self->sync_clock_time = clock_time;
+    }
+  }
+}
+
+/* Set the NTP time of our SRs to the clock time their RTP timestamp stands
+ * for, by the mapping of the last sent packet. Like rtpbin's clock-time NTP
+ * source, clock time is taken as time since the NTP epoch */
+static void gst_rocsend_rewrite_sr_ntp(GstRocSend *self, guint8 *data,
+                                       gsize size) {
+  gsize offset = 0;
+
+  while (offset + 8 <= size) {
+    guint8 *p = data + offset;
+    const gsize len = (GST_READ_UINT16_BE(p + 2) + 1) * 4;
+    if ((p[0] >> 6) != 2 || offset + len > size)
+      break;
+
+    if (p[1] == GST_RTCP_TYPE_SR && len >= 28 &&
+        GST_READ_UINT32_BE(p + 4) == self->out_ssrc) {
+      const gint32 delta =
+          (gint32)(GST_READ_UINT32_BE(p + 16) - self->sync_rtp_ts);
+      const GstClockTime span = gst_util_uint64_scale_int(
+          ABS((gint64)delta), GST_SECOND, self->config_state.rate);
+      GstClockTime clock_time = self->sync_clock_time;
+      if (delta >= 0)
+        clock_time += span;
+      else
+        clock_time = clock_time > span ? clock_time - span : 0;
+      GST_WRITE_UINT64_BE(p + 8, gst_util_uint64_scale(
+                                     clock_time, G_GUINT64_CONSTANT(1) << 32,
+                                     GST_SECOND));
+    }
+    offset += len;
+  }
+}
+
+/* The encoder counts the packets DTX suppressed as sent, and only the packets
+ * it sent itself. Correct the sender packet and octet counts of our SRs so
+ * they cover the whole outgoing stream */
+static void gst_rocsend_rewrite_sr_counts(GstRocSend *self, guint8 *data,
+                                          gsize size) {
+  gsize offset = 0;
+
+  while (offset + 8 <= size) {
+    guint8 *p = data + offset;
+    const gsize len = (GST_READ_UINT16_BE(p + 2) + 1) * 4;
+    if ((p[0] >> 6) != 2 || offset + len > size)
+      break;
+
+    if (p[1] == GST_RTCP_TYPE_SR && len >= 28 &&
+        GST_READ_UINT32_BE(p + 4) == self->out_ssrc) {
+      GST_WRITE_UINT32_BE(p + 20, GST_READ_UINT32_BE(p + 20) +
+                                      self->sr_packet_offset);
+      GST_WRITE_UINT32_BE(p + 24, GST_READ_UINT32_BE(p + 24) +
+                                      self->sr_octet_offset);
+    }
+    offset += len;
+  }
+}
+
+/* Rewrite SSRCs (and SR RTP timestamps) in a compound RTCP packet. Outgoing
+ * packets get the encoder's SSRC replaced by the stream's, incoming report
+ * blocks about the stream are pointed back at the encoder */
+static void gst_rocsend_rewrite_rtcp(guint8 *data, gsize size, guint32 from,
+                                     guint32 to, guint32 ts_offset,
+                                     gboolean outgoing) {
+  gsize offset = 0;
+
+  while (offset + 8 <= size) {
+    guint8 *p = data + offset;
+    const guint count = p[0] & 0x1f;
+    const guint8 type = p[1];
+    const gsize len = (GST_READ_UINT16_BE(p + 2) + 1) * 4;
+    if ((p[0] >> 6) != 2 || offset + len > size)
+      break;
+
+    if (outgoing) {
+      /* SR, RR, SDES, BYE, XR and feedback all start with the sender */
+      if (GST_READ_UINT32_BE(p + 4) == from) {
+        GST_WRITE_UINT32_BE(p + 4, to);
+        if (type == GST_RTCP_TYPE_SR && len >= 28)
+          GST_WRITE_UINT32_BE(p + 16, GST_READ_UINT32_BE(p + 16) + ts_offset);
+      }
+    } else if (type == GST_RTCP_TYPE_SR || type == GST_RTCP_TYPE_RR) {
+      const gsize blocks = type == GST_RTCP_TYPE_SR ? 28 : 8;
+      for (guint i = 0; i < count && blocks + (i + 1) * 24 <= len; i++) {
+        guint8 *block = p + blocks + i * 24;
+        if (GST_READ_UINT32_BE(block) == from)
+          GST_WRITE_UINT32_BE(block, to);
+      }
+    } else if ((type == GST_RTCP_TYPE_RTPFB || type == GST_RTCP_TYPE_PSFB) &&
+               len >= 12 && GST_READ_UINT32_BE(p + 8) == from) {
+      GST_WRITE_UINT32_BE(p + 8, to);
+    }
+    offset += len;
+  }
+}
+
+/* Latency live input is rendered with: the pipeline latency once the
+ * LATENCY event arrived, what upstream reports until then */
+static GstClockTime gst_rocsend_get_latency(GstRocSend *self) {
+  GST_OBJECT_LOCK(self);
+  GstClockTime latency = self->latency;
+  GST_OBJECT_UNLOCK(self);
+  if (GST_CLOCK_TIME_IS_VALID(latency))
+    return latency;
+
+  GstQuery *query = gst_query_new_latency();
+  gboolean live = FALSE;
+  GstClockTime min = 0;
+  if (gst_pad_peer_query(self->sinkpad, query))
+    gst_query_parse_latency(query, &live, &min, NULL);
+  gst_query_unref(query);
+  latency = live && GST_CLOCK_TIME_IS_VALID(min) ? min : 0;
+
+  GST_OBJECT_LOCK(self);
+  if (!GST_CLOCK_TIME_IS_VALID(self->latency))
+    self->latency = latency;
+  GST_OBJECT_UNLOCK(self);
+  return latency;
+}
+
+/* Whether input at @pts is too late to be worth sending: its end plus
+ * max-lateness is behind downstream's earliest QoS time, or behind the
+ * pipeline clock less the latency, as a sink would see it. @lateness is set
+ * to how far behind it is */
+static gboolean gst_rocsend_input_is_late(GstRocSend *self, GstClockTime pts,
+                                          GstClockTime duration,
+                                          GstClockTime *running_time,
+                                          GstClockTimeDiff *lateness) {
+  GstClock *clock = NULL;
+  GstClockTime base_time = 0;
+
+  if (!GST_CLOCK_TIME_IS_VALID(pts) || self->segment.format != GST_FORMAT_TIME)
+    return FALSE;
+  *running_time =
+      gst_segment_to_running_time(&self->segment, GST_FORMAT_TIME, pts);
+  if (!GST_CLOCK_TIME_IS_VALID(*running_time))
+    return FALSE;
+
+  GST_OBJECT_LOCK(self);
+  GstClockTime limit = self->earliest_time;
+  if (GST_STATE(self) == GST_STATE_PLAYING && GST_ELEMENT_CLOCK(self)) {
+    clock = gst_object_ref(GST_ELEMENT_CLOCK(self));
+    base_time = GST_ELEMENT_CAST(self)->base_time;
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  if (clock) {
+    const GstClockTime now = gst_clock_get_time(clock);
+    gst_object_unref(clock);
+    base_time += gst_rocsend_get_latency(self);
+    if (now > base_time &&
+        (!GST_CLOCK_TIME_IS_VALID(limit) || now - base_time > limit))
+      limit = now - base_time;
+  }
+  if (!GST_CLOCK_TIME_IS_VALID(limit))
+    return FALSE;
+
+  const GstClockTime deadline = *running_time +
+                                (GST_CLOCK_TIME_IS_VALID(duration) ? duration
+                                                                   : 0) +
+                                self->active.max_lateness;
+  *lateness = GST_CLOCK_DIFF(deadline, limit);
+  return *lateness > 0;
+}
+
+/* Throw away a late input buffer, per late-policy, and report it */
+static void gst_rocsend_drop_late(GstRocSend *self, GstBuffer *buf,
+                                  GstClockTime running_time,
+                                  GstClockTimeDiff lateness) {
+  const GstClockTime pts = GST_BUFFER_PTS(buf);
+  const guint64 frames =
+      gst_buffer_get_size(buf) / MAX(1, GST_AUDIO_INFO_BPF(&self->audio_info));
+  const GstClockTime duration =
+      GST_BUFFER_DURATION_IS_VALID(buf)
+          ? GST_BUFFER_DURATION(buf)
+          : gst_util_uint64_scale_int(frames, GST_SECOND,
+                                      MAX(1, self->config_state.rate));
+
+  GST_DEBUG_OBJECT(self,
+                   "Dropping input at %" GST_TIME_FORMAT ", %" GST_STIME_FORMAT
+                   " late",
+                   GST_TIME_ARGS(running_time), GST_STIME_ARGS(lateness));
+
+  /* Skipping keeps the RTP clock in step with the input, receivers see a
+   * gap. Dropping lets the stream close up, removing the backlog from the
+   * receiver's latency. On the pipeline clock timebase the RTP clock has to
+   * keep counting clock time, or it would drift from the PTS that SRs map
+   * it to, so there both policies skip */
+  if (self->active.late_policy == GST_ROCSEND_LATE_POLICY_SKIP ||
+      self->clock_timebase) {
+    if (self->rebase_pending)
+      self->rebase_ts += (guint32)frames;
+    else
+      self->ts_offset += (guint32)frames;
+  }
+  if (GST_CLOCK_TIME_IS_VALID(self->last_pts))
+    self->last_pts += duration;
+  if (GST_CLOCK_TIME_IS_VALID(self->last_dts))
+    self->last_dts += duration;
+
+  GST_OBJECT_LOCK(self);
+  self->buffers_processed++;
+  self->buffers_late++;
+  self->late_duration += duration;
+  const guint64 processed = self->buffers_processed;
+  const guint64 dropped = self->buffers_late;
+  const gdouble proportion = self->proportion;
+  GST_OBJECT_UNLOCK(self);
+
+  GstMessage *msg = gst_message_new_qos(
+      GST_OBJECT(self), TRUE, running_time,
+      gst_segment_to_stream_time(&self->segment, GST_FORMAT_TIME, pts), pts,
+      duration);
+  gst_message_set_qos_values(msg, lateness, proportion, 1000000);
+  gst_message_set_qos_stats(msg, GST_FORMAT_BUFFERS, processed, dropped);
+  gst_element_post_message(GST_ELEMENT(self), msg);
+}
+
+/* Start measuring the capture rate from scratch and stop correcting it */
+static void gst_rocsend_drift_reset(GstRocSend *self) {
+  if (self->resampler) {
+    gst_audio_resampler_free(self->resampler);
+    self->resampler = NULL;
+  }
+  self->drift_anchor = GST_CLOCK_TIME_NONE;
+  self->drift_ratio = 0;
+  GST_OBJECT_LOCK(self);
+  self->drift_ppm = 0;
+  GST_OBJECT_UNLOCK(self);
+}
+
+/* Resampler rate for the stream rate times @ratio, scaled up for sub-ppm
+ * steps as far as a gint allows */
+static gint gst_rocsend_drift_rate(GstRocSend *self, gdouble ratio) {
+  const guint64 rate = MAX(1, self->config_state.rate);
+  const guint64 scale =
+      CLAMP((guint64)G_MAXINT / 2 / rate, 1, DRIFT_RATE_SCALE);
+  return (gint)(rate * scale * ratio + 0.5);
+}
+
+/* Count @frames arriving now. How late they arrive against the clock time
+ * their count stands for drifts with the capture rate; arrival jitter only
+ * adds to it, so each window keeps its least delay and the rate comes from
+ * the slope across up to DRIFT_POINTS windows */
+static void gst_rocsend_drift_measure(GstRocSend *self, guint64 frames) {
+  GstClock *clock = NULL;
+
+  GST_OBJECT_LOCK(self);
+  if (GST_STATE(self) == GST_STATE_PLAYING && GST_ELEMENT_CLOCK(self))
+    clock = gst_object_ref(GST_ELEMENT_CLOCK(self));
+  GST_OBJECT_UNLOCK(self);
+  if (!clock)
+    return;
+
+  const GstClockTime now = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+
+  /* Frames in the buffer that starts the count were captured before it */
+  if (!GST_CLOCK_TIME_IS_VALID(self->drift_anchor) ||
+      now < self->drift_anchor) {
+    self->drift_anchor = now;
+    self->drift_frames = 0;
+    self->drift_window_end = DRIFT_WINDOW;
+    self->drift_window_min = G_MAXDOUBLE;
+    self->drift_n_points = 0;
+    self->drift_next_point = 0;
+    return;
+  }
+  self->drift_frames += frames;
+
+  const GstClockTime elapsed = now - self->drift_anchor;
+  const gdouble pos =
+      (gdouble)self->drift_frames * GST_SECOND / self->config_state.rate;
+  const gdouble delay = (gdouble)elapsed - pos;
+  if (delay < self->drift_window_min) {
+    self->drift_window_min = delay;
+    self->drift_window_pos = pos;
+  }
+  if (elapsed < self->drift_window_end)
+    return;
+
+  self->drift_window_end = elapsed + DRIFT_WINDOW;
+  self->drift_points[self->drift_next_point].pos = self->drift_window_pos;
+  self->drift_points[self->drift_next_point].delay = self->drift_window_min;
+  self->drift_next_point = (self->drift_next_point + 1) % DRIFT_POINTS;
+  self->drift_n_points = MIN(self->drift_n_points + 1, DRIFT_POINTS);
+  self->drift_window_min = G_MAXDOUBLE;
+  if (self->drift_n_points < 2)
+    return;
+
+  const guint first =
+      self->drift_n_points < DRIFT_POINTS ? 0 : self->drift_next_point;
+  const guint last =
+      (self->drift_next_point + DRIFT_POINTS - 1) % DRIFT_POINTS;
+  const gdouble span =
+      self->drift_points[last].pos - self->drift_points[first].pos;
+  const gdouble measured =
+      span / (span + self->drift_points[last].delay -
+              self->drift_points[first].delay);
+
+  if (!(fabs(measured - 1.0) * 1e6 <= DRIFT_MAX_PPM)) {
+    GST_DEBUG_OBJECT(self, "Restarting rate measurement, off by %.0f ppm",
+                     (measured - 1.0) * 1e6);
+    self->drift_anchor = GST_CLOCK_TIME_NONE;
+    return;
+  }
+  /* Estimates improve as the span grows, follow them until it is full */
+  if (self->drift_ratio == 0 || self->drift_n_points < DRIFT_POINTS)
+    self->drift_ratio = measured;
+  else
+    self->drift_ratio += DRIFT_FILTER_ALPHA * (measured - self->drift_ratio);
+
+  GST_OBJECT_LOCK(self);
+  self->drift_ppm = (self->drift_ratio - 1.0) * 1e6;
+  GST_OBJECT_UNLOCK(self);
+  GST_LOG_OBJECT(self, "Capture rate %.2f ppm off (span %.2f ppm)",
+                 (self->drift_ratio - 1.0) * 1e6, (measured - 1.0) * 1e6);
+
+  if (self->resampler) {
+    gst_audio_resampler_update(self->resampler,
+                               gst_rocsend_drift_rate(self, self->drift_ratio),
+                               gst_rocsend_drift_rate(self, 1.0), NULL);
+  }
+}
+
+/* Resample @frame from the measured capture rate to the nominal rate */
+static void gst_rocsend_drift_correct(GstRocSend *self, roc_frame *frame) {
+  const gint channels = MAX(1, self->frame_channels);
+  const gint out_rate = gst_rocsend_drift_rate(self, 1.0);
+
+  if (self->resampler && self->resampler_channels != channels) {
+    gst_audio_resampler_free(self->resampler);
+    self->resampler = NULL;
+  }
+  if (!self->resampler) {
+    const gint in_rate = gst_rocsend_drift_rate(self, self->drift_ratio);
+    GstStructure *options =
+        gst_structure_new_empty("GstAudioResampler.options");
+    gst_audio_resampler_options_set_quality(
+        GST_AUDIO_RESAMPLER_METHOD_KAISER,
+        GST_AUDIO_RESAMPLER_QUALITY_DEFAULT, in_rate, out_rate, options);
+    self->resampler = gst_audio_resampler_new(
+        GST_AUDIO_RESAMPLER_METHOD_KAISER,
+        GST_AUDIO_RESAMPLER_FLAG_VARIABLE_RATE, GST_AUDIO_FORMAT_F32LE,
+        channels, in_rate, out_rate, options);
+    gst_structure_free(options);
+    self->resampler_channels = channels;
+    if (!self->resampler) {
+      GST_WARNING_OBJECT(self, "Failed to create drift resampler");
+      return;
+    }
+  }
+
+  const gsize in_frames = frame->samples_size / sizeof(gfloat) / channels;
+  const gsize out_frames =
+      gst_audio_resampler_get_out_frames(self->resampler, in_frames);
+  const gsize size = out_frames * channels * sizeof(gfloat);
+  if (size > self->resample_buf_size) {
+    g_free(self->resample_buf);
+    self->resample_buf = g_malloc(size);
+    self->resample_buf_size = size;
+  }
+
+  gpointer in[1] = {frame->samples};
+  gpointer out[1] = {self->resample_buf};
+  gst_audio_resampler_resample(self->resampler, in, in_frames, out,
+                               out_frames);
+  frame->samples = self->resample_buf;
+  frame->samples_size = size;
+}
+
+/* Hand a feedback packet to the encoder. Call with encoder_lock held, or
+ * from the streaming thread */
+static void gst_rocsend_push_feedback(GstRocSend *self, guint8 *data,
+                                      gsize size) {
+  roc_packet packet;
+  packet.bytes = data;
+  packet.bytes_size = size;
+
+  const GstClockTime trace_start = gst_rocsend_trace_begin();
+  const int push_res = roc_sender_encoder_push_feedback_packet(
+      self->encoder, ROC_INTERFACE_AUDIO_CONTROL, &packet);
+  gst_rocsend_trace_end(GST_ELEMENT(self), GST_ROCSEND_TRACE_PUSH_FEEDBACK,
+                        trace_start);
+  if (push_res != 0) {
+    GST_WARNING_OBJECT(self,
+                       "Failed to push RTCP feedback packet to ROC encoder");
+  } else {
+    GST_LOG_OBJECT(self,
+                   "Successfully pushed RTCP feedback packet to ROC encoder");
+    GST_OBJECT_LOCK(self);
+    self->feedback_applied++;
+    GST_OBJECT_UNLOCK(self);
+  }
+}
+
+/* Copy a feedback packet into the next free slot for the streaming thread.
+ * rtcp_sink_chain is the only producer */
+static void gst_rocsend_feedback_enqueue(GstRocSend *self, const guint8 *data,
+                                         gsize size) {
+  const guint tail = (guint)g_atomic_int_get(&self->feedback_tail);
+  const guint head = (guint)g_atomic_int_get(&self->feedback_head);
+
+  if (tail - head == FEEDBACK_QUEUE_SIZE || size > PACKET_BUFFER_SIZE) {
+    GST_DEBUG_OBJECT(self, "Dropping RTCP feedback packet of %" G_GSIZE_FORMAT
+                           " bytes, queue holds %u",
+                     size, tail - head);
+    GST_OBJECT_LOCK(self);
+    self->feedback_dropped++;
+    GST_OBJECT_UNLOCK(self);
+    return;
+  }
+
+  GstRocSendFeedbackSlot *slot =
+      &self->feedback_slots[tail & (FEEDBACK_QUEUE_SIZE - 1)];
+  memcpy(slot->data, data, size);
+  slot->size = size;
+  ROCSEND_PROBE_FEEDBACK_INGEST(self, size);
+  /* Publishes the slot contents along with the index */
+  g_atomic_int_set(&self->feedback_tail, (gint)(tail + 1));
+}
+
+/* Apply the feedback queued since the last buffer. Streaming thread only,
+ * which also owns the encoder and its SSRC */
+static void gst_rocsend_apply_feedback(GstRocSend *self) {
+  guint head = (guint)g_atomic_int_get(&self->feedback_head);
+  const guint tail = (guint)g_atomic_int_get(&self->feedback_tail);
+
+  if (head == tail)
+    return;
+
+  for (; head != tail; head++) {
+    GstRocSendFeedbackSlot *slot =
+        &self->feedback_slots[head & (FEEDBACK_QUEUE_SIZE - 1)];
+    if (self->out_ssrc_valid && self->enc_ssrc_valid &&
+        self->enc_ssrc != self->out_ssrc)
+      gst_rocsend_rewrite_rtcp(slot->data, slot->size, self->out_ssrc,
+                               self->enc_ssrc, 0, FALSE);
+    gst_rocsend_push_feedback(self, slot->data, slot->size);
+  }
+  g_atomic_int_set(&self->feedback_head, (gint)head);
+}
+
+/* Time to stamp the packets captured by one chain call with: the pipeline
+ * clock time, or system time without a clock. GST_CLOCK_TIME_NONE when not
+ * capturing */
+static GstClockTime gst_rocsend_dump_time(GstRocSend *self) {
+  if (!g_atomic_pointer_get(&self->dump))
+    return GST_CLOCK_TIME_NONE;
+
+  GstClock *clock = gst_element_get_clock(GST_ELEMENT(self));
+  if (!clock)
+    return g_get_real_time() * GST_USECOND;
+  const GstClockTime now = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+  return now;
+}
+
+/* Capture a packet. Registering as a user first keeps close_dump from
+ * freeing the writer under us */
+static void gst_rocsend_dump(GstRocSend *self, GstRocPcapFlow flow,
+                             GstClockTime time, const guint8 *data,
+                             gsize size) {
+  g_atomic_int_inc(&self->dump_users);
+  GstRocPcapWriter *dump = g_atomic_pointer_get(&self->dump);
+  if (dump)
+    gst_roc_pcap_writer_write(dump, time, flow, data, size);
+  g_atomic_int_add(&self->dump_users, -1);
+}
+
+static void gst_rocsend_dump_buffer(GstRocSend *self, GstRocPcapFlow flow,
+                                    GstClockTime time, GstBuffer *buf) {
+  GstMapInfo map;
+
+  if (!gst_buffer_map(buf, &map, GST_MAP_READ))
+    return;
+  gst_rocsend_dump(self, flow, time, map.data, map.size);
+  gst_buffer_unmap(buf, &map);
+}
+
+/* Buffer for the encoder to pop a packet into. Pool buffers come back
+ * resized to PACKET_BUFFER_SIZE once downstream is done with them */
+static GstBuffer *gst_rocsend_alloc_packet(GstRocSend *self) {
+  GstBuffer *buf = NULL;
+
+  if (gst_buffer_pool_acquire_buffer(self->packet_pool, &buf, NULL) !=
+      GST_FLOW_OK)
+    buf = gst_buffer_new_allocate(NULL, PACKET_BUFFER_SIZE, NULL);
+  return buf;
+}
+
 static GstFlowReturn gst_rocsend_chain(GstPad *pad, GstObject *parent,
                                        GstBuffer *buf) {
   GstRocSend *self = GST_ROCSEND(parent);
@@ -255,121 +1914,238 @@ static GstFlowReturn gst_rocsend_chain(GstPad *pad, GstObject *parent,
     return GST_FLOW_OK;
   }
 
-  if (!gst_buffer_map(buf, &info, GST_MAP_READ)) {
-    GST_ERROR_OBJECT(self, "Failed to map input buffer for reading");
+  gst_rocsend_update_settings(self);
+  if (self->handoff_active)
+    gst_rocsend_apply_feedback(self);
+
+  GstClockTime running_time;
+  GstClockTimeDiff lateness;
+  if (self->active.max_lateness >= 0 &&
+      gst_rocsend_input_is_late(self, pts, GST_BUFFER_DURATION(buf),
+                                &running_time, &lateness)) {
+    gst_rocsend_drop_late(self, buf, running_time, lateness);
     gst_buffer_unref(buf);
-    return GST_FLOW_ERROR;
+    return GST_FLOW_OK;
   }
 
   roc_frame frame;
   memset(&frame, 0, sizeof(frame));
-  frame.samples = info.data;
-  frame.samples_size = info.size;
 
-  if (roc_sender_encoder_push_frame(self->encoder, &frame) != 0) {
-    GST_ERROR_OBJECT(self, "Failed to push frame to ROC encoder");
+  const gboolean planar =
+      GST_AUDIO_INFO_LAYOUT(&self->audio_info) ==
+      GST_AUDIO_LAYOUT_NON_INTERLEAVED;
+  if (planar || self->mixer) {
+    /* ROC consumes interleaved frames with the encoder's channel count, so
+     * planar or remixed input is converted into the reusable frame buffer */
+    GstAudioBuffer abuf;
+    if (!gst_audio_buffer_map(&abuf, &self->audio_info, buf, GST_MAP_READ)) {
+      GST_ERROR_OBJECT(self, "Failed to map audio input buffer for reading");
+      gst_buffer_unref(buf);
+      return GST_FLOW_ERROR;
+    }
+    const gsize frames = GST_AUDIO_BUFFER_N_SAMPLES(&abuf);
+    const gsize size = frames * self->frame_channels * sizeof(gfloat);
+    if (size > self->frame_buf_size) {
+      g_free(self->frame_buf);
+      self->frame_buf = g_malloc(size);
+      self->frame_buf_size = size;
+    }
+    if (self->mixer) {
+      gpointer out[1] = {self->frame_buf};
+      gst_audio_channel_mixer_samples(self->mixer, abuf.planes, out, frames);
+    } else {
+      gst_roc_interleave_f32(self->frame_buf,
+                             (const gfloat *const *)abuf.planes,
+                             GST_AUDIO_INFO_CHANNELS(&self->audio_info),
+                             frames);
+    }
+    gst_audio_buffer_unmap(&abuf);
+    frame.samples = self->frame_buf;
+    frame.samples_size = size;
+  } else {
+    if (!gst_buffer_map(buf, &info, GST_MAP_READ)) {
+      GST_ERROR_OBJECT(self, "Failed to map input buffer for reading");
+      gst_buffer_unref(buf);
+      return GST_FLOW_ERROR;
+    }
+    frame.samples = info.data;
+    frame.samples_size = info.size;
+  }
+
+  if (self->active.drift_compensation) {
+    if (GST_BUFFER_IS_DISCONT(buf))
+      self->drift_anchor = GST_CLOCK_TIME_NONE;
+    gst_rocsend_drift_measure(self, frame.samples_size / sizeof(gfloat) /
+                                        MAX(1, self->frame_channels));
+    if (self->drift_ratio > 0)
+      gst_rocsend_drift_correct(self, &frame);
+  } else if (self->drift_ratio > 0) {
+    gst_rocsend_drift_reset(self);
+  }
+
+  if (self->active.dtx)
+    gst_rocsend_dtx_update(self, &frame);
+
+  ROCSEND_PROBE_FRAME_PUSH(self, frame.samples_size);
+  const GstClockTime trace_start = gst_rocsend_trace_begin();
+  const int push_res = roc_sender_encoder_push_frame(self->encoder, &frame);
+  gst_rocsend_trace_end(GST_ELEMENT(self), GST_ROCSEND_TRACE_PUSH_FRAME,
+                        trace_start);
+  if (!planar && !self->mixer)
     gst_buffer_unmap(buf, &info);
-    gst_buffer_unref(buf);
+  gst_buffer_unref(buf);
+
+  if (push_res != 0) {
+    GST_ERROR_OBJECT(self, "Failed to push frame to ROC encoder");
     return GST_FLOW_ERROR;
   }
+  self->frames_pushed +=
+      frame.samples_size / sizeof(gfloat) / MAX(1, self->frame_channels);
 
-  gst_buffer_unmap(buf, &info);
-  gst_buffer_unref(buf);
+  const GstClockTime dump_time = gst_rocsend_dump_time(self);
 
   /* Pop RTP packets from encoder */
   gboolean more_packets;
   gsize out_pkt_i = 0;
+  guint64 sent = 0, suppressed = 0;
   do {
-    /* Allocate buffer for RTP packet (max size 2048 bytes) */
-    GstBuffer *outbuf = gst_buffer_new_allocate(NULL, 2048, NULL);
+    GstBuffer *outbuf = gst_rocsend_alloc_packet(self);
     if (!gst_buffer_map(outbuf, &info, GST_MAP_WRITE)) {
       GST_ERROR_OBJECT(self, "Failed to map output buffer");
       gst_buffer_unref(outbuf);
-      return GST_FLOW_ERROR;
+      ret = GST_FLOW_ERROR;
+      break;
     }
 
     roc_packet packet;
     packet.bytes = info.data;
     packet.bytes_size = info.size;
 
+    const GstClockTime pop_start = gst_rocsend_trace_begin();
     more_packets =
         (roc_sender_encoder_pop_packet(
              self->encoder, ROC_INTERFACE_AUDIO_SOURCE, &packet) == 0);
+    gst_rocsend_trace_end(GST_ELEMENT(self), GST_ROCSEND_TRACE_POP_PACKET,
+                          pop_start);
+    gst_buffer_unmap(outbuf, &info);
+
+    if (!more_packets || packet.duration == 0) {
+      gst_buffer_unref(outbuf);
+      continue;
+    }
+
+    gst_buffer_resize(outbuf, 0, packet.bytes_size);
+    const GstClockTime ts_delta = (GstClockTime)packet.duration;
+    ROCSEND_PROBE_PACKET_POP(self, packet.bytes_size, ts_delta);
+    const gboolean keep = gst_rocsend_dtx_keep_packet(self, ts_delta);
+    const guint32 samples = gst_util_uint64_scale_int_round(
+        ts_delta, self->config_state.rate, GST_SECOND);
+    self->frames_emitted += samples;
+
+    /* Set PTS and DTS to egress buffer based on the input buffer, samplerate
+     * and RTP timestamp */
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (gst_rtp_buffer_map(outbuf, GST_MAP_READWRITE, &rtp)) {
+      const guint32 timestamp = gst_rtp_buffer_get_timestamp(&rtp);
+      self->prev_timestamp = timestamp;
+      self->prev_timestamp_valid = TRUE;
+      GST_LOG_OBJECT(self, "timestamp: %u,\tdelta: %" GST_TIME_FORMAT
+                     ", internal PTS %" GST_TIME_FORMAT
+                     ", internal DTS %" GST_TIME_FORMAT,
+                     timestamp, GST_TIME_ARGS(ts_delta), GST_TIME_ARGS (self->last_pts),
+                     GST_TIME_ARGS (self->last_dts));
+      if (G_UNLIKELY(!GST_CLOCK_TIME_IS_VALID(self->last_pts) &&
+                     GST_CLOCK_TIME_IS_VALID(pts))) {
+        self->last_pts = pts;
+        GST_LOG_OBJECT(self, "initialize internal pts: %" GST_TIME_FORMAT,
+                       GST_TIME_ARGS(pts));
+      }
+      if (G_UNLIKELY(!GST_CLOCK_TIME_IS_VALID(self->last_dts) &&
+                     GST_CLOCK_TIME_IS_VALID(dts))) {
+        self->last_dts = dts;
+        GST_LOG_OBJECT(self, "initialize internal dts: %" GST_TIME_FORMAT,
+                       GST_TIME_ARGS(dts));
+      }
+      GST_BUFFER_DURATION(outbuf) = ts_delta;
+      GST_BUFFER_PTS(outbuf) = self->last_pts;
+      if (out_pkt_i == 0 && GST_CLOCK_TIME_IS_VALID(self->last_pts) &&
+          GST_CLOCK_TIME_IS_VALID(pts) && pts < self->last_pts) {
+        GST_WARNING_OBJECT(self,
+                           "PTS (%" GST_TIME_FORMAT
+                           ") after repacketization by roc become "
+                           "ahead of input stream ts (%" GST_TIME_FORMAT ")",
+                           GST_TIME_ARGS(self->last_pts), GST_TIME_ARGS(pts));
+        self->last_pts = GST_BUFFER_PTS(outbuf) = pts;
+      }
+      GST_BUFFER_DTS(outbuf) = self->last_dts;
+      if (out_pkt_i == 0 && GST_CLOCK_TIME_IS_VALID(self->last_dts) &&
+          GST_CLOCK_TIME_IS_VALID(dts) && dts < self->last_dts) {
+        GST_WARNING_OBJECT(self,
+                           "DTS (%" GST_TIME_FORMAT
+                           ") after repacketization by roc become "
+                           "ahead of input stream ts (%" GST_TIME_FORMAT ")",
+                           GST_TIME_ARGS(self->last_dts), GST_TIME_ARGS(dts));
+        self->last_dts = GST_BUFFER_DTS(outbuf) = dts;
+      }
+      out_pkt_i += 1;
+      if (G_LIKELY(GST_CLOCK_TIME_IS_VALID(self->last_pts))) {
+        self->last_pts += ts_delta;
+        GST_LOG_OBJECT (self, "update internal PTS %" GST_TIME_FORMAT, GST_TIME_ARGS (self->last_pts));
+      }
+      if (G_LIKELY(GST_CLOCK_TIME_IS_VALID(self->last_dts))) {
+        self->last_dts += ts_delta;
+      }
 
-    if (more_packets && packet.duration > 0) {
-      /* Set PTS and DTS to egress buffer based on the input buffer, samplerate
-       * and RTP timestamp */
-      GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
-      if (gst_rtp_buffer_map(outbuf, GST_MAP_READ, &rtp)) {
-        const guint32 timestamp = gst_rtp_buffer_get_timestamp(&rtp);
-        const GstClockTime ts_delta = (GstClockTime)packet.duration;
-        self->prev_timestamp = timestamp;
-        self->prev_timestamp_valid = TRUE;
-        GST_LOG_OBJECT(self, "timestamp: %u,\tdelta: %" GST_TIME_FORMAT
-                       ", internal PTS %" GST_TIME_FORMAT
-                       ", internal DTS %" GST_TIME_FORMAT,
-                       timestamp, GST_TIME_ARGS(ts_delta), GST_TIME_ARGS (self->last_pts),
-                       GST_TIME_ARGS (self->last_dts));
-        if (G_UNLIKELY(!GST_CLOCK_TIME_IS_VALID(self->last_pts) &&
-                       GST_CLOCK_TIME_IS_VALID(pts))) {
-          self->last_pts = pts;
-          GST_LOG_OBJECT(self, "initialize internal pts: %" GST_TIME_FORMAT,
-                         GST_TIME_ARGS(pts));
-        }
-        if (G_UNLIKELY(!GST_CLOCK_TIME_IS_VALID(self->last_dts) &&
-                       GST_CLOCK_TIME_IS_VALID(dts))) {
-          self->last_dts = dts;
-          GST_LOG_OBJECT(self, "initialize internal dts: %" GST_TIME_FORMAT,
-                         GST_TIME_ARGS(dts));
-        }
-        GST_BUFFER_DURATION(outbuf) = ts_delta;
-        GST_BUFFER_PTS(outbuf) = self->last_pts;
-        if (out_pkt_i == 0 && GST_CLOCK_TIME_IS_VALID(self->last_pts) &&
-            GST_CLOCK_TIME_IS_VALID(pts) && pts < self->last_pts) {
-          GST_WARNING_OBJECT(self,
-                             "PTS (%" GST_TIME_FORMAT
-                             ") after repacketization by roc become "
-                             "ahead of input stream ts (%" GST_TIME_FORMAT ")",
-                             GST_TIME_ARGS(self->last_pts), GST_TIME_ARGS(pts));
-          self->last_pts = GST_BUFFER_PTS(outbuf) = pts;
-        }
-        GST_BUFFER_DTS(outbuf) = self->last_dts;
-        if (out_pkt_i == 0 && GST_CLOCK_TIME_IS_VALID(self->last_dts) &&
-            GST_CLOCK_TIME_IS_VALID(dts) && dts < self->last_dts) {
-          GST_WARNING_OBJECT(self,
-                             "DTS (%" GST_TIME_FORMAT
-                             ") after repacketization by roc become "
-                             "ahead of input stream ts (%" GST_TIME_FORMAT ")",
-                             GST_TIME_ARGS(self->last_dts), GST_TIME_ARGS(dts));
-          self->last_dts = GST_BUFFER_DTS(outbuf) = dts;
-        }
-        out_pkt_i += 1;
-        if (G_LIKELY(GST_CLOCK_TIME_IS_VALID(self->last_pts))) {
-          self->last_pts += ts_delta;
-          GST_LOG_OBJECT (self, "update internal PTS %" GST_TIME_FORMAT, GST_TIME_ARGS (self->last_pts));
-        }
-        if (G_LIKELY(GST_CLOCK_TIME_IS_VALID(self->last_dts))) {
-          self->last_dts += ts_delta;
-        }
-        gst_rtp_buffer_unmap(&rtp);
+      gst_rocsend_rewrite_rtp(self, &rtp, GST_BUFFER_PTS(outbuf), samples,
+                              keep);
+      if (keep)
+        self->sent_octets += gst_rtp_buffer_get_payload_len(&rtp);
+      else
+        self->sr_octet_offset -= gst_rtp_buffer_get_payload_len(&rtp);
+      if (keep && self->talkspurt_start) {
+        gst_rtp_buffer_set_marker(&rtp, TRUE);
+        self->talkspurt_start = FALSE;
       }
+      gst_rtp_buffer_unmap(&rtp);
+    }
+
+    if (!keep) {
+      GST_LOG_OBJECT(self, "Suppressing silent packet (DTX)");
+      self->seq_offset--;
+      self->sr_packet_offset--;
+      suppressed++;
+      gst_buffer_unref(outbuf);
+      continue;
+    }
 
-      gst_buffer_unmap(outbuf, &info);
-      gst_buffer_resize(outbuf, 0, packet.bytes_size);
+    self->sent_packets++;
+    /* The header was rewritten above, no need to map it again */
+    gst_rocsend_history_add(self, self->last_seq, self->out_ssrc, outbuf);
 
-      GST_LOG("Pushing buffer %" GST_PTR_FORMAT, outbuf);
+    GST_LOG("Pushing buffer %" GST_PTR_FORMAT, outbuf);
+    if (GST_CLOCK_TIME_IS_VALID(dump_time))
+      gst_rocsend_dump_buffer(self, GST_ROC_PCAP_RTP, dump_time, outbuf);
+    if (self->pacing_active)
+      ret = gst_rocsend_pace_enqueue(self, GST_MINI_OBJECT_CAST(outbuf));
+    else
       ret = gst_pad_push(self->srcpad, outbuf);
-      if (ret != GST_FLOW_OK) {
-        GST_ERROR_OBJECT(self, "Failed to push RTP packet: %s",
-                         gst_flow_get_name(ret));
-        return ret;
-      }
-    } else {
-      gst_buffer_unmap(outbuf, &info);
-      gst_buffer_unref(outbuf);
+    if (ret != GST_FLOW_OK) {
+      GST_ERROR_OBJECT(self, "Failed to push RTP packet: %s",
+                       gst_flow_get_name(ret));
+      break;
     }
+    sent++;
   } while (more_packets);
 
+  GST_OBJECT_LOCK(self);
+  self->buffers_processed++;
+  self->packets_sent += sent;
+  self->packets_suppressed += suppressed;
+  GST_OBJECT_UNLOCK(self);
+
+  if (ret != GST_FLOW_OK)
+    return ret;
+
   /* Pop RTCP packets from encoder if RTCP source pad exists */
   GST_INFO_OBJECT(self,
                   "RTCP check: rtcp_src_pad=%p, rtcp_interface_activated=%d",
@@ -377,8 +2153,7 @@ static GstFlowReturn gst_rocsend_chain(GstPad *pad, GstObject *parent,
   if (self->rtcp_src_pad && self->rtcp_interface_activated) {
     GST_TRACE_OBJECT(self, "Attempting to pop RTCP packets");
     do {
-      /* Allocate buffer for RTCP packet (max size 2048 bytes) */
-      GstBuffer *rtcp_outbuf = gst_buffer_new_allocate(NULL, 2048, NULL);
+      GstBuffer *rtcp_outbuf = gst_rocsend_alloc_packet(self);
       if (!gst_buffer_map(rtcp_outbuf, &info, GST_MAP_WRITE)) {
         GST_ERROR_OBJECT(self, "Failed to map RTCP output buffer");
         gst_buffer_unref(rtcp_outbuf);
@@ -389,15 +2164,33 @@ static GstFlowReturn gst_rocsend_chain(GstPad *pad, GstObject *parent,
       rtcp_packet.bytes = info.data;
       rtcp_packet.bytes_size = info.size;
 
+      const GstClockTime pop_start = gst_rocsend_trace_begin();
       more_packets =
           (roc_sender_encoder_pop_packet(
                self->encoder, ROC_INTERFACE_AUDIO_CONTROL, &rtcp_packet) == 0);
+      gst_rocsend_trace_end(GST_ELEMENT(self), GST_ROCSEND_TRACE_POP_CONTROL,
+                            pop_start);
 
       GST_TRACE_OBJECT(self, "RTCP pop_packet returned: %s, size: %zu",
                        more_packets ? "success" : "no packets",
                        rtcp_packet.bytes_size);
 
       if (more_packets) {
+        if (self->out_ssrc_valid && self->enc_ssrc_valid &&
+            (self->enc_ssrc != self->out_ssrc || self->ts_offset != 0))
+          gst_rocsend_rewrite_rtcp(info.data, rtcp_packet.bytes_size,
+                                   self->enc_ssrc, self->out_ssrc,
+                                   self->ts_offset, TRUE);
+        if (self->clock_timebase &&
+            GST_CLOCK_TIME_IS_VALID(self->sync_clock_time))
+          gst_rocsend_rewrite_sr_ntp(self, info.data, rtcp_packet.bytes_size);
+        if (self->out_ssrc_valid &&
+            (self->sr_packet_offset != 0 || self->sr_octet_offset != 0))
+          gst_rocsend_rewrite_sr_counts(self, info.data,
+                                        rtcp_packet.bytes_size);
+        if (GST_CLOCK_TIME_IS_VALID(dump_time))
+          gst_rocsend_dump(self, GST_ROC_PCAP_RTCP, dump_time, info.data,
+                           rtcp_packet.bytes_size);
         gst_buffer_unmap(rtcp_outbuf, &info);
         gst_buffer_resize(rtcp_outbuf, 0, rtcp_packet.bytes_size);
 
@@ -407,6 +2200,7 @@ static GstFlowReturn gst_rocsend_chain(GstPad *pad, GstObject *parent,
 
         GST_LOG_OBJECT(self, "Pushing RTCP buffer %" GST_PTR_FORMAT,
                        rtcp_outbuf);
+        ROCSEND_PROBE_RTCP_PUSH(self, rtcp_packet.bytes_size);
         ret = gst_pad_push(self->rtcp_src_pad, rtcp_outbuf);
         if (ret != GST_FLOW_OK) {
           GST_ERROR_OBJECT(self, "Failed to push RTCP packet: %s",
@@ -454,17 +2248,195 @@ static gboolean gst_rocsend_rtcp_sink_event(GstPad *pad, GstObject *parent,
   return res;
 }
 
+/* Push stream-start, caps and segment before the first retransmission,
+ * and new caps whenever the RTX or the media payload type changes */
+static void gst_rocsend_rtx_start(GstRocSend *self, GstPad *pad, guint8 rtx_pt,
+                                  guint8 media_pt) {
+  const gboolean start = !self->rtx_started;
+
+  if (!start && rtx_pt == self->rtx_caps_pt && media_pt == self->rtx_caps_apt)
+    return;
+
+  if (start) {
+    gchar *stream_id = gst_pad_create_stream_id(pad, GST_ELEMENT(self), "rtx");
+    gst_pad_push_event(pad, gst_event_new_stream_start(stream_id));
+    g_free(stream_id);
+  }
+
+  GstCaps *caps = gst_caps_new_simple(
+      "application/x-rtp", "media", G_TYPE_STRING, "audio", "clock-rate",
+      G_TYPE_INT, self->config_state.rate, "encoding-name", G_TYPE_STRING,
+      "RTX", "payload", G_TYPE_INT, (gint)rtx_pt, "apt", G_TYPE_UINT,
+      (guint)media_pt, NULL);
+  gst_pad_push_event(pad, gst_event_new_caps(caps));
+  gst_caps_unref(caps);
+  self->rtx_caps_pt = rtx_pt;
+  self->rtx_caps_apt = media_pt;
+
+  if (start) {
+    GstSegment segment;
+    gst_segment_init(&segment, GST_FORMAT_TIME);
+    gst_pad_push_event(pad, gst_event_new_segment(&segment));
+    self->rtx_started = TRUE;
+  }
+}
+
+/* Wrap a sent packet into an RFC 4588 retransmission packet */
+static GstBuffer *gst_rocsend_make_rtx(GstRocSend *self, GstBuffer *orig,
+                                       guint8 rtx_pt, guint8 *media_pt) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  GstRTPBuffer rtx = GST_RTP_BUFFER_INIT;
+
+  if (!gst_rtp_buffer_map(orig, GST_MAP_READ, &rtp))
+    return NULL;
+
+  /* Keep the original header, CSRCs and extensions included, and put the
+   * OSN in front of the payload. Padding is not carried over */
+  const guint header_len = gst_rtp_buffer_get_header_len(&rtp);
+  const guint payload_len = gst_rtp_buffer_get_payload_len(&rtp);
+  const gsize size = header_len + 2 + payload_len;
+  GstBuffer *outbuf = size <= PACKET_BUFFER_SIZE
+                          ? gst_rocsend_alloc_packet(self)
+                          : gst_buffer_new_allocate(NULL, size, NULL);
+  gst_buffer_resize(outbuf, 0, size);
+
+  GstMapInfo map;
+  if (gst_buffer_map(outbuf, &map, GST_MAP_WRITE)) {
+    gst_buffer_extract(orig, 0, map.data, header_len);
+    map.data[0] &= ~0x20;
+    gst_buffer_unmap(outbuf, &map);
+  }
+  if (!gst_rtp_buffer_map(outbuf, GST_MAP_WRITE, &rtx)) {
+    gst_rtp_buffer_unmap(&rtp);
+    gst_buffer_unref(outbuf);
+    return NULL;
+  }
+
+  const guint16 osn = gst_rtp_buffer_get_seq(&rtp);
+  *media_pt = gst_rtp_buffer_get_payload_type(&rtp);
+  gst_rtp_buffer_set_ssrc(&rtx, self->rtx_ssrc);
+  gst_rtp_buffer_set_seq(&rtx, self->rtx_seq++);
+  gst_rtp_buffer_set_payload_type(&rtx, rtx_pt);
+
+  guint8 *payload = gst_rtp_buffer_get_payload(&rtx);
+  GST_WRITE_UINT16_BE(payload, osn);
+  memcpy(payload + 2, gst_rtp_buffer_get_payload(&rtp), payload_len);
+
+  gst_rtp_buffer_unmap(&rtx);
+  gst_rtp_buffer_unmap(&rtp);
+
+  GST_BUFFER_PTS(outbuf) = GST_BUFFER_PTS(orig);
+  GST_BUFFER_DTS(outbuf) = GST_BUFFER_DTS(orig);
+  GST_BUFFER_DURATION(outbuf) = GST_BUFFER_DURATION(orig);
+  return outbuf;
+}
+
+static void gst_rocsend_retransmit(GstRocSend *self, GstPad *rtx_pad,
+                                   guint16 seq, GstClockTime dump_time) {
+  GstBuffer *orig = gst_rocsend_history_lookup(self, seq);
+  if (!orig) {
+    GST_DEBUG_OBJECT(self, "NACKed packet #%u no longer in history", seq);
+    GST_OBJECT_LOCK(self);
+    self->retransmissions_missed++;
+    GST_OBJECT_UNLOCK(self);
+    return;
+  }
+
+  g_mutex_lock(&self->rtx_lock);
+  const guint8 rtx_pt = self->rtx_payload_type;
+  g_mutex_unlock(&self->rtx_lock);
+
+  guint8 media_pt = 0;
+  GstBuffer *rtx = gst_rocsend_make_rtx(self, orig, rtx_pt, &media_pt);
+  gst_buffer_unref(orig);
+  if (!rtx)
+    return;
+
+  gst_rocsend_rtx_start(self, rtx_pad, rtx_pt, media_pt);
+
+  GST_LOG_OBJECT(self, "Retransmitting packet #%u", seq);
+  if (GST_CLOCK_TIME_IS_VALID(dump_time))
+    gst_rocsend_dump_buffer(self, GST_ROC_PCAP_RTX, dump_time, rtx);
+  if (gst_pad_push(rtx_pad, rtx) == GST_FLOW_OK) {
+    GST_OBJECT_LOCK(self);
+    self->packets_retransmitted++;
+    GST_OBJECT_UNLOCK(self);
+  }
+}
+
+/* Resend packets requested by RTCP generic NACKs (RFC 4585, 6.2.1) */
+static void gst_rocsend_handle_nacks(GstRocSend *self, GstBuffer *buf,
+                                     GstClockTime dump_time) {
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  GstRTCPPacket packet;
+  GstPad *rtx_pad = NULL;
+
+  GST_OBJECT_LOCK(self);
+  if (self->rtx_src_pad)
+    rtx_pad = gst_object_ref(self->rtx_src_pad);
+  GST_OBJECT_UNLOCK(self);
+
+  g_mutex_lock(&self->rtx_lock);
+  const gboolean enabled = self->rtx_history_len > 0 && self->media_ssrc_valid;
+  const guint32 media_ssrc = self->media_ssrc;
+  g_mutex_unlock(&self->rtx_lock);
+
+  if (!rtx_pad || !enabled)
+    goto out;
+  if (!gst_rtcp_buffer_validate_reduced(buf) ||
+      !gst_rtcp_buffer_map(buf, GST_MAP_READ, &rtcp))
+    goto out;
+
+  gboolean more = gst_rtcp_buffer_get_first_packet(&rtcp, &packet);
+  while (more) {
+    if (gst_rtcp_packet_get_type(&packet) == GST_RTCP_TYPE_RTPFB &&
+        gst_rtcp_packet_fb_get_type(&packet) == GST_RTCP_RTPFB_TYPE_NACK &&
+        gst_rtcp_packet_fb_get_media_ssrc(&packet) == media_ssrc) {
+      const guint8 *fci = gst_rtcp_packet_fb_get_fci(&packet);
+      const guint fci_len = gst_rtcp_packet_fb_get_fci_length(&packet);
+
+      GST_OBJECT_LOCK(self);
+      self->nacks_received++;
+      GST_OBJECT_UNLOCK(self);
+
+      /* Each FCI word is a packet ID and a bitmask of the 16 following */
+      for (guint i = 0; i < fci_len; i++) {
+        const guint16 pid = GST_READ_UINT16_BE(fci + i * 4);
+        const guint16 blp = GST_READ_UINT16_BE(fci + i * 4 + 2);
+        gst_rocsend_retransmit(self, rtx_pad, pid, dump_time);
+        for (guint bit = 0; bit < 16; bit++) {
+          if (blp & (1 << bit))
+            gst_rocsend_retransmit(self, rtx_pad, pid + bit + 1, dump_time);
+        }
+      }
+    }
+    more = gst_rtcp_packet_move_to_next(&packet);
+  }
+  gst_rtcp_buffer_unmap(&rtcp);
+
+out:
+  if (rtx_pad)
+    gst_object_unref(rtx_pad);
+}
+
 /* RTCP sink pad chain handler - receives feedback packets from decoder */
 static GstFlowReturn gst_rocsend_rtcp_sink_chain(GstPad *pad, GstObject *parent,
                                                  GstBuffer *buf) {
   GstRocSend *self = GST_ROCSEND(parent);
+  GstMapInfo map;
   guint8 *packet_data = NULL;
+  guint8 *rewritten = NULL;
   gsize packet_size;
   (void)pad; /* unused */
 
   GST_LOG_OBJECT(self, "Received RTCP feedback buffer %" GST_PTR_FORMAT, buf);
 
-  if (!self->encoder || !self->rtcp_interface_activated) {
+  const GstClockTime dump_time = gst_rocsend_dump_time(self);
+  if (GST_CLOCK_TIME_IS_VALID(dump_time))
+    gst_rocsend_dump_buffer(self, GST_ROC_PCAP_FEEDBACK, dump_time, buf);
+  gst_rocsend_handle_nacks(self, buf, dump_time);
+
+  if (!self->rtcp_interface_activated) {
     GST_DEBUG_OBJECT(self, "Encoder not ready or RTCP interface not activated, "
                            "dropping RTCP feedback packet");
     gst_buffer_unref(buf);
@@ -478,31 +2450,48 @@ static GstFlowReturn gst_rocsend_rtcp_sink_chain(GstPad *pad, GstObject *parent,
     return GST_FLOW_OK;
   }
 
-  /* Extract and duplicate buffer data into contiguous memory
-   * This handles buffers with memory spread across multiple chunks */
-  gst_buffer_extract_dup(buf, 0, packet_size, (gpointer *)&packet_data,
-                         &packet_size);
-  if (!packet_data) {
-    GST_ERROR_OBJECT(self, "Failed to extract RTCP feedback packet data");
+  /* Mapping only copies buffers with memory spread across several chunks,
+   * feedback from a socket comes in one */
+  if (!gst_buffer_map(buf, &map, GST_MAP_READ)) {
+    GST_ERROR_OBJECT(self, "Failed to map RTCP feedback packet");
     gst_buffer_unref(buf);
     return GST_FLOW_ERROR;
   }
+  packet_data = map.data;
+  packet_size = map.size;
 
-  /* Push feedback packet to ROC encoder */
-  roc_packet packet;
-  packet.bytes = packet_data;
-  packet.bytes_size = packet_size;
+  if (self->handoff_active) {
+    gst_rocsend_feedback_enqueue(self, packet_data, packet_size);
+    gst_buffer_unmap(buf, &map);
+    gst_buffer_unref(buf);
+    return GST_FLOW_OK;
+  }
 
-  if (roc_sender_encoder_push_feedback_packet(
-          self->encoder, ROC_INTERFACE_AUDIO_CONTROL, &packet) != 0) {
-    GST_WARNING_OBJECT(self,
-                       "Failed to push RTCP feedback packet to ROC encoder");
-  } else {
-    GST_LOG_OBJECT(self,
-                   "Successfully pushed RTCP feedback packet to ROC encoder");
+  ROCSEND_PROBE_FEEDBACK_INGEST(self, packet_size);
+  /* The streaming thread may swap encoders after a settings change */
+  g_mutex_lock(&self->encoder_lock);
+  if (!self->encoder) {
+    g_mutex_unlock(&self->encoder_lock);
+    GST_DEBUG_OBJECT(self, "Encoder not ready, dropping RTCP feedback packet");
+    gst_buffer_unmap(buf, &map);
+    gst_buffer_unref(buf);
+    return GST_FLOW_OK;
+  }
+  /* Receivers report on the stream SSRC, which a rebuilt encoder doesn't
+   * know as its own */
+  if (self->out_ssrc_valid && self->enc_ssrc_valid &&
+      self->enc_ssrc != self->out_ssrc) {
+    rewritten = g_malloc(map.size);
+    memcpy(rewritten, map.data, map.size);
+    gst_rocsend_rewrite_rtcp(rewritten, packet_size, self->out_ssrc,
+                             self->enc_ssrc, 0, FALSE);
+    packet_data = rewritten;
   }
+  gst_rocsend_push_feedback(self, packet_data, packet_size);
+  g_mutex_unlock(&self->encoder_lock);
 
-  g_free(packet_data);
+  g_free(rewritten);
+  gst_buffer_unmap(buf, &map);
   gst_buffer_unref(buf);
 
   return GST_FLOW_OK;
@@ -565,11 +2554,40 @@ static GstPad *gst_rocsend_request_new_pad(GstElement *element,
     GST_INFO_OBJECT(
         self, "Created RTCP sink pad (will be activated on state transition)");
 
+  } else if (g_str_equal(templ_name, "rtx_src_%u")) {
+    /* Create source pad for retransmitted packets */
+    if (self->rtx_src_pad) {
+      GST_WARNING_OBJECT(self, "RTX source pad already exists");
+      return NULL;
+    }
+
+    newpad = gst_pad_new_from_template(templ, "rtx_src_0");
+    if (!newpad) {
+      GST_ERROR_OBJECT(self, "Failed to create RTX source pad");
+      return NULL;
+    }
+
+    GST_OBJECT_LOCK(self);
+    self->rtx_src_pad = newpad;
+    self->rtx_started = FALSE;
+    GST_OBJECT_UNLOCK(self);
+    GST_INFO_OBJECT(self, "Created RTX source pad");
+
+    gst_pad_set_active(newpad, TRUE);
+    gst_element_add_pad(element, newpad);
+    return newpad;
+
   } else {
     GST_WARNING_OBJECT(self, "Unknown pad template: %s", templ_name);
     return NULL;
   }
 
+  /* A prewarmed encoder was built before this pad existed */
+  if (self->encoder && !self->rtcp_interface_activated &&
+      !gst_rocsend_activate_rtcp(self)) {
+    GST_WARNING_OBJECT(self, "RTCP will stay inactive on prewarmed encoder");
+  }
+
   gst_pad_set_active(newpad, TRUE);
   gst_element_add_pad(element, newpad);
 
@@ -589,102 +2607,545 @@ static void gst_rocsend_release_pad(GstElement *element, GstPad *pad) {
     self->rtcp_sink_pad = NULL;
     self->config_state.rtcp_sink_requested = FALSE;
     GST_INFO_OBJECT(self, "Released RTCP sink pad");
+  } else if (pad == self->rtx_src_pad) {
+    GST_OBJECT_LOCK(self);
+    self->rtx_src_pad = NULL;
+    GST_OBJECT_UNLOCK(self);
+    GST_INFO_OBJECT(self, "Released RTX source pad");
   }
 
   gst_pad_set_active(pad, FALSE);
   gst_element_remove_pad(element, pad);
 }
 
-/* Initialize ROC encoder with collected configuration */
-static gboolean gst_rocsend_initialize_encoder(GstRocSend *self) {
-  GST_INFO_OBJECT(self, "Initializing ROC encoder");
+/* Parse audio caps into the configuration state used to build the encoder */
+static gboolean gst_rocsend_configure_from_caps(GstRocSend *self,
+                                                GstCaps *caps) {
+  if (self->negotiated_caps)
+    gst_caps_unref(self->negotiated_caps);
+  self->negotiated_caps = gst_caps_copy(caps);
+
+  // Parse caps to get audio format
+  GstStructure *s = gst_caps_get_structure(caps, 0);
+  const gchar *format = gst_structure_get_string(s, "format");
+  gint rate = 0, channels = 0;
+  gst_structure_get_int(s, "rate", &rate);
+  gst_structure_get_int(s, "channels", &channels);
+
+  if (!gst_audio_info_from_caps(&self->audio_info, caps)) {
+    GST_ERROR_OBJECT(self, "Failed to parse audio caps %" GST_PTR_FORMAT,
+                     caps);
+    return FALSE;
+  }
+
+  // Store configuration for deferred initialization
+  self->config_state.rate = rate;
+  self->config_state.channels = channels;
+
+  if (g_strcmp0(format, "F32LE") == 0) {
+    self->config_state.format = ROC_FORMAT_PCM;
+    self->config_state.subformat = ROC_SUBFORMAT_PCM_FLOAT32_LE;
+  } else {
+    GST_ERROR_OBJECT(
+        self, "Unsupported format for ROC encoder: %s (only F32LE supported)",
+        format);
+    return FALSE;
+  }
+
+  self->config_state.caps_negotiated = TRUE;
+  GST_INFO_OBJECT(self,
+                  "Stored caps configuration: channels=%d, format=%s, rate=%d",
+                  channels, format, rate);
+  return TRUE;
+}
+
+/* Open ROC context if not already done */
+static gboolean gst_rocsend_open_context(GstRocSend *self) {
+  if (self->context)
+    return TRUE;
+
+  GST_LOG_OBJECT(self, "Opening ROC context");
+  roc_context_config context_config;
+  memset(&context_config, 0, sizeof(context_config));
+  if (roc_context_open(&context_config, &self->context) != 0) {
+    GST_ERROR_OBJECT(self, "Failed to open ROC context");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void gst_rocsend_close_encoder(GstRocSend *self) {
+  gst_rocsend_finish_rebuild(self, FALSE);
+  if (!self->encoder)
+    return;
 
-  /* Initialize ROC context if not already done */
-  if (!self->context) {
-    GST_LOG_OBJECT(self, "Opening ROC context");
-    roc_context_config context_config;
-    memset(&context_config, 0, sizeof(context_config));
-    if (roc_context_open(&context_config, &self->context) != 0) {
-      GST_ERROR_OBJECT(self, "Failed to open ROC context");
+  g_mutex_lock(&self->encoder_lock);
+  roc_sender_encoder *encoder = self->encoder;
+  self->encoder = NULL;
+  g_mutex_unlock(&self->encoder_lock);
+  roc_sender_encoder_close(encoder);
+  self->encoder_activated = FALSE;
+  self->rtcp_interface_activated = FALSE;
+  GST_INFO_OBJECT(self, "ROC encoder closed");
+}
+
+/* Activate RTCP control interface on an already opened encoder */
+static gboolean gst_rocsend_activate_rtcp(GstRocSend *self) {
+  GST_LOG_OBJECT(self, "Activating RTCP control interface");
+  if (roc_sender_encoder_activate(self->encoder, ROC_INTERFACE_AUDIO_CONTROL,
+                                  ROC_PROTO_RTCP) != 0) {
+    GST_ERROR_OBJECT(self, "Failed to activate RTCP control interface");
+    return FALSE;
+  }
+  self->rtcp_interface_activated = TRUE;
+  GST_INFO_OBJECT(self, "RTCP control interface activated");
+  return TRUE;
+}
+
+/* Build the encoder from prewarm-caps ahead of the first CAPS event */
+static gboolean gst_rocsend_prewarm(GstRocSend *self) {
+  GstCaps *caps;
+  gboolean res = TRUE;
+
+  GST_OBJECT_LOCK(self);
+  caps = self->prewarm_caps ? gst_caps_ref(self->prewarm_caps) : NULL;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!caps || self->encoder)
+    goto done;
+
+  if (!gst_caps_is_fixed(caps)) {
+    GST_WARNING_OBJECT(self, "prewarm-caps %" GST_PTR_FORMAT
+                       " are not fixed, skipping prewarm", caps);
+    goto done;
+  }
+
+  GST_INFO_OBJECT(self, "Prewarming ROC encoder for %" GST_PTR_FORMAT, caps);
+  res = gst_rocsend_configure_from_caps(self, caps) &&
+        gst_rocsend_initialize_encoder(self);
+
+done:
+  if (caps)
+    gst_caps_unref(caps);
+  return res;
+}
+
+/* Build the channel mixer (if any) placed in front of an encoder using
+ * @packet_encoding: an explicit mix-matrix, or an automatic downmix when the
+ * caps carry more channels than the packet encoding */
+static gboolean gst_rocsend_build_mixer(GstRocSend *self,
+                                        guint packet_encoding,
+                                        GstAudioChannelMixer **mixer_out,
+                                        gint *channels_out) {
+  const GstAudioInfo *info = &self->audio_info;
+  const gint in_channels = GST_AUDIO_INFO_CHANNELS(info);
+  const gint enc_channels =
+      gst_rocsend_packet_encoding_channels(packet_encoding);
+  GstAudioChannelMixerFlags flags = GST_AUDIO_CHANNEL_MIXER_FLAGS_NONE;
+  GstAudioChannelMixer *mixer = NULL;
+  gfloat **matrix = NULL;
+  gint out_channels = in_channels;
+
+  if (GST_AUDIO_INFO_LAYOUT(info) == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+    flags |= GST_AUDIO_CHANNEL_MIXER_FLAGS_NON_INTERLEAVED_IN;
+
+  GST_OBJECT_LOCK(self);
+  const gboolean downmix = self->downmix;
+  const guint rows = gst_value_array_get_size(&self->mix_matrix);
+  if (rows > 0) {
+    const GValue *row0 = gst_value_array_get_value(&self->mix_matrix, 0);
+    if (gst_value_array_get_size(row0) != (guint)in_channels) {
+      GST_OBJECT_UNLOCK(self);
+      GST_ERROR_OBJECT(self,
+                       "mix-matrix has %u input columns but caps have %d "
+                       "channels",
+                       gst_value_array_get_size(row0), in_channels);
       return FALSE;
     }
+    out_channels = rows;
+    matrix = g_new(gfloat *, in_channels);
+    for (gint i = 0; i < in_channels; i++) {
+      matrix[i] = g_new(gfloat, out_channels);
+      for (gint j = 0; j < out_channels; j++) {
+        const GValue *row = gst_value_array_get_value(&self->mix_matrix, j);
+        matrix[i][j] = g_value_get_float(gst_value_array_get_value(row, i));
+      }
+    }
+  }
+  GST_OBJECT_UNLOCK(self);
+
+  if (matrix) {
+    mixer = gst_audio_channel_mixer_new_with_matrix(
+        flags | GST_AUDIO_CHANNEL_MIXER_FLAGS_UNPOSITIONED_IN |
+            GST_AUDIO_CHANNEL_MIXER_FLAGS_UNPOSITIONED_OUT,
+        GST_AUDIO_FORMAT_F32LE, in_channels, out_channels, matrix);
+  } else if (downmix && enc_channels > 0 &&
+             in_channels > enc_channels && in_channels <= 64) {
+    static const GstAudioChannelPosition mono_pos[] = {
+        GST_AUDIO_CHANNEL_POSITION_MONO};
+    static const GstAudioChannelPosition stereo_pos[] = {
+        GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+        GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT};
+    GstAudioChannelPosition in_pos[64];
+    GstAudioChannelPosition out_pos[2];
+
+    if (GST_AUDIO_INFO_IS_UNPOSITIONED(info))
+      flags |= GST_AUDIO_CHANNEL_MIXER_FLAGS_UNPOSITIONED_IN;
+    memcpy(in_pos, info->position, sizeof(in_pos[0]) * in_channels);
+    memcpy(out_pos, enc_channels == 1 ? mono_pos : stereo_pos,
+           sizeof(out_pos[0]) * enc_channels);
+    out_channels = enc_channels;
+    mixer = gst_audio_channel_mixer_new(flags, GST_AUDIO_FORMAT_F32LE,
+                                        in_channels, in_pos, out_channels,
+                                        out_pos);
   }
 
-  /* Close existing encoder if any */
-  if (self->encoder) {
-    GST_LOG_OBJECT(self, "Closing existing encoder before re-creation");
-    roc_sender_encoder_close(self->encoder);
-    self->encoder = NULL;
-    self->encoder_activated = FALSE;
-    self->rtcp_interface_activated = FALSE;
+  /* ROC would get multitrack frames for an encoding that carries fewer
+   * channels, refuse the caps instead */
+  if (enc_channels > 0 && out_channels > enc_channels) {
+    GST_ERROR_OBJECT(self,
+                     "Packet encoding carries %d channels but frames would "
+                     "have %d, enable downmix or set mix-matrix",
+                     enc_channels, out_channels);
+    if (mixer)
+      gst_audio_channel_mixer_free(mixer);
+    return FALSE;
+  }
+  if (out_channels != in_channels && !mixer) {
+    GST_ERROR_OBJECT(self, "Failed to create channel mixer %d -> %d",
+                     in_channels, out_channels);
+    return FALSE;
+  }
+  if (mixer && gst_audio_channel_mixer_is_passthrough(mixer)) {
+    gst_audio_channel_mixer_free(mixer);
+    mixer = NULL;
+  }
+  if (mixer) {
+    GST_INFO_OBJECT(self, "Mixing %d input channels into %d", in_channels,
+                    out_channels);
   }
 
-  /* Build encoder config from stored configuration state */
-  memset(&self->encoder_config, 0, sizeof(self->encoder_config));
+  *mixer_out = mixer;
+  *channels_out = out_channels;
+  return TRUE;
+}
+
+static gboolean gst_rocsend_setup_mixer(GstRocSend *self) {
+  if (self->mixer) {
+    gst_audio_channel_mixer_free(self->mixer);
+    self->mixer = NULL;
+  }
+  return gst_rocsend_build_mixer(self, self->active.packet_encoding,
+                                 &self->mixer, &self->frame_channels);
+}
+
+/* Fill an encoder config from the caps, the channel count of the frames the
+ * encoder will get and the tuning settings */
+static void gst_rocsend_fill_encoder_config(GstRocSend *self,
+                                            const GstRocSendSettings *settings,
+                                            gint frame_channels,
+                                            roc_sender_config *config) {
+  memset(config, 0, sizeof(*config));
 
   /* Frame encoding from caps */
-  self->encoder_config.frame_encoding.rate = self->config_state.rate;
-  self->encoder_config.frame_encoding.channels =
-      self->config_state.channel_layout;
-  self->encoder_config.frame_encoding.format = self->config_state.format;
-  self->encoder_config.frame_encoding.subformat = self->config_state.subformat;
-  if (self->config_state.channel_layout == ROC_CHANNEL_LAYOUT_MULTITRACK) {
-    self->encoder_config.frame_encoding.tracks = self->config_state.tracks;
+  config->frame_encoding.rate = self->config_state.rate;
+  config->frame_encoding.format = self->config_state.format;
+  config->frame_encoding.subformat = self->config_state.subformat;
+  if (frame_channels == 1) {
+    config->frame_encoding.channels = ROC_CHANNEL_LAYOUT_MONO;
+  } else if (frame_channels == 2) {
+    config->frame_encoding.channels = ROC_CHANNEL_LAYOUT_STEREO;
+  } else {
+    config->frame_encoding.channels = ROC_CHANNEL_LAYOUT_MULTITRACK;
+    config->frame_encoding.tracks = frame_channels;
   }
 
   /* Apply user-configured properties */
-  self->encoder_config.packet_encoding = self->packet_encoding;
-  self->encoder_config.packet_length = self->packet_length;
-  self->encoder_config.fec_encoding = ROC_FEC_ENCODING_DISABLE;
-  self->encoder_config.clock_source = ROC_CLOCK_SOURCE_EXTERNAL;
+  config->packet_encoding = settings->packet_encoding;
+  config->packet_length = settings->packet_length;
+  config->fec_encoding = ROC_FEC_ENCODING_DISABLE;
+  config->clock_source = ROC_CLOCK_SOURCE_EXTERNAL;
+}
 
-  GST_DEBUG_OBJECT(
-      self,
-      "Encoder config: channels=%d, format=%d, rate=%d, packet_encoding=%d",
-      self->config_state.channels, self->config_state.format,
-      self->config_state.rate, self->packet_encoding);
+/* Open an encoder and activate its interfaces, NULL on failure */
+static roc_sender_encoder *
+gst_rocsend_open_encoder(GstRocSend *self, roc_sender_config *config,
+                         gboolean with_rtcp) {
+  roc_sender_encoder *encoder = NULL;
 
-  /* Create encoder */
   GST_LOG_OBJECT(self, "Opening ROC sender encoder");
-  if (roc_sender_encoder_open(self->context, &self->encoder_config,
-                              &self->encoder) != 0) {
+  if (roc_sender_encoder_open(self->context, config, &encoder) != 0) {
     GST_ERROR_OBJECT(self, "Failed to open ROC sender encoder");
-    return FALSE;
+    return NULL;
   }
 
-  /* Activate RTP audio source interface */
   GST_LOG_OBJECT(self, "Activating audio source interface with RTP");
-  if (roc_sender_encoder_activate(self->encoder, ROC_INTERFACE_AUDIO_SOURCE,
+  if (roc_sender_encoder_activate(encoder, ROC_INTERFACE_AUDIO_SOURCE,
                                   ROC_PROTO_RTP) != 0) {
     GST_ERROR_OBJECT(self, "Failed to activate audio source interface");
-    roc_sender_encoder_close(self->encoder);
-    self->encoder = NULL;
+    roc_sender_encoder_close(encoder);
+    return NULL;
+  }
+
+  if (with_rtcp &&
+      roc_sender_encoder_activate(encoder, ROC_INTERFACE_AUDIO_CONTROL,
+                                  ROC_PROTO_RTCP) != 0) {
+    GST_ERROR_OBJECT(self, "Failed to activate RTCP control interface");
+    roc_sender_encoder_close(encoder);
+    return NULL;
+  }
+  return encoder;
+}
+
+/* Derive the header offsets from the first packet of the next encoder, so
+ * the stream carries on where the current encoder leaves it. Samples the
+ * current encoder still buffers are dropped, and the timestamp skips over
+ * them to stay in step with the input */
+static void gst_rocsend_prepare_rebase(GstRocSend *self) {
+  if (self->out_ssrc_valid) {
+    const guint64 buffered = self->frames_pushed > self->frames_emitted
+                                 ? self->frames_pushed - self->frames_emitted
+                                 : 0;
+    self->rebase_ts = self->next_ts + (guint32)buffered;
+    self->rebase_pending = TRUE;
+    /* The next encoder counts from zero on the same SSRC */
+    self->sr_packet_offset = self->sent_packets;
+    self->sr_octet_offset = self->sent_octets;
+  }
+  self->frames_pushed = 0;
+  self->frames_emitted = 0;
+
+  g_mutex_lock(&self->encoder_lock);
+  self->enc_ssrc_valid = FALSE;
+  g_mutex_unlock(&self->encoder_lock);
+}
+
+/* Forget the outgoing stream, the next packet starts a new one */
+static void gst_rocsend_reset_stream(GstRocSend *self) {
+  self->seq_offset = 0;
+  self->ts_offset = 0;
+  self->clock_timebase = FALSE;
+  self->sync_clock_time = GST_CLOCK_TIME_NONE;
+  self->rebase_pending = FALSE;
+  self->frames_pushed = 0;
+  self->frames_emitted = 0;
+  self->sent_packets = 0;
+  self->sent_octets = 0;
+  self->sr_packet_offset = 0;
+  self->sr_octet_offset = 0;
+  g_mutex_lock(&self->encoder_lock);
+  self->out_ssrc_valid = FALSE;
+  self->enc_ssrc_valid = FALSE;
+  g_mutex_unlock(&self->encoder_lock);
+}
+
+/* Initialize ROC encoder with collected configuration */
+static gboolean gst_rocsend_initialize_encoder(GstRocSend *self) {
+  GST_INFO_OBJECT(self, "Initializing ROC encoder");
+
+  if (!gst_rocsend_open_context(self))
     return FALSE;
+
+  gst_rocsend_take_settings(self);
+
+  /* Close existing encoder if any */
+  if (self->encoder) {
+    GST_LOG_OBJECT(self, "Closing existing encoder before re-creation");
+    gst_rocsend_prepare_rebase(self);
+    gst_rocsend_close_encoder(self);
   }
 
-  self->encoder_activated = TRUE;
-  GST_INFO_OBJECT(self, "Audio source interface activated");
+  if (!gst_rocsend_setup_mixer(self))
+    return FALSE;
+
+  /* Build encoder config from stored configuration state */
+  gst_rocsend_fill_encoder_config(self, &self->active, self->frame_channels,
+                                  &self->encoder_config);
+  self->config_state.channel_layout =
+      self->encoder_config.frame_encoding.channels;
+  self->config_state.tracks = self->encoder_config.frame_encoding.tracks;
+
+  GST_DEBUG_OBJECT(
+      self,
+      "Encoder config: channels=%d, format=%d, rate=%d, packet_encoding=%d",
+      self->config_state.channels, self->config_state.format,
+      self->config_state.rate, self->active.packet_encoding);
 
   /* Activate RTCP interface if any RTCP pads were requested */
-  if (self->config_state.rtcp_src_requested ||
-      self->config_state.rtcp_sink_requested) {
-    GST_LOG_OBJECT(self, "Activating RTCP control interface");
-    if (roc_sender_encoder_activate(self->encoder, ROC_INTERFACE_AUDIO_CONTROL,
-                                    ROC_PROTO_RTCP) != 0) {
-      GST_ERROR_OBJECT(self, "Failed to activate RTCP control interface");
-      roc_sender_encoder_close(self->encoder);
-      self->encoder = NULL;
-      self->encoder_activated = FALSE;
-      return FALSE;
+  const gboolean with_rtcp = self->config_state.rtcp_src_requested ||
+                             self->config_state.rtcp_sink_requested;
+  roc_sender_encoder *encoder =
+      gst_rocsend_open_encoder(self, &self->encoder_config, with_rtcp);
+  if (!encoder)
+    return FALSE;
+
+  g_mutex_lock(&self->encoder_lock);
+  self->encoder = encoder;
+  g_mutex_unlock(&self->encoder_lock);
+  self->encoder_activated = TRUE;
+  self->rtcp_interface_activated = with_rtcp;
+
+  GST_INFO_OBJECT(self, "ROC encoder successfully initialized");
+  return TRUE;
+}
+
+static gpointer gst_rocsend_rebuild_func(gpointer data) {
+  GstRocSend *self = data;
+
+  self->rebuild_encoder = gst_rocsend_open_encoder(
+      self, &self->rebuild_config, self->rebuild_rtcp);
+  g_atomic_int_set(&self->rebuild_done, 1);
+  return NULL;
+}
+
+/* Open an encoder for the active settings on a helper thread, while the
+ * current one keeps encoding */
+static void gst_rocsend_start_rebuild(GstRocSend *self) {
+  GST_INFO_OBJECT(self,
+                  "Rebuilding encoder for packet-encoding=%u "
+                  "packet-length=%" GST_TIME_FORMAT,
+                  self->active.packet_encoding,
+                  GST_TIME_ARGS(self->active.packet_length));
+
+  if (!gst_rocsend_build_mixer(self, self->active.packet_encoding,
+                               &self->rebuild_mixer,
+                               &self->rebuild_channels)) {
+    goto failed;
+  }
+  gst_rocsend_fill_encoder_config(self, &self->active, self->rebuild_channels,
+                                  &self->rebuild_config);
+
+  self->rebuild_rtcp = self->rtcp_interface_activated;
+  g_atomic_int_set(&self->rebuild_done, 0);
+  self->rebuild_thread =
+      g_thread_try_new("rocsend-rebuild", gst_rocsend_rebuild_func, self,
+                       NULL);
+  if (self->rebuild_thread)
+    return;
+
+  if (self->rebuild_mixer) {
+    gst_audio_channel_mixer_free(self->rebuild_mixer);
+    self->rebuild_mixer = NULL;
+  }
+
+failed:
+  /* Stay on the current encoder until the properties change again */
+  self->active.packet_encoding = self->encoder_config.packet_encoding;
+  self->active.packet_length = self->encoder_config.packet_length;
+  GST_ELEMENT_WARNING(self, LIBRARY, SETTINGS, (NULL),
+                      ("Failed to rebuild encoder, keeping current settings"));
+}
+
+/* Join the rebuild thread and, if @apply, switch to the new encoder */
+static void gst_rocsend_finish_rebuild(GstRocSend *self, gboolean apply) {
+  if (!self->rebuild_thread)
+    return;
+
+  g_thread_join(self->rebuild_thread);
+  self->rebuild_thread = NULL;
+
+  roc_sender_encoder *encoder = self->rebuild_encoder;
+  self->rebuild_encoder = NULL;
+  if (!apply || !encoder) {
+    if (encoder)
+      roc_sender_encoder_close(encoder);
+    if (self->rebuild_mixer) {
+      gst_audio_channel_mixer_free(self->rebuild_mixer);
+      self->rebuild_mixer = NULL;
+    }
+    if (apply) {
+      self->active.packet_encoding = self->encoder_config.packet_encoding;
+      self->active.packet_length = self->encoder_config.packet_length;
+      GST_ELEMENT_WARNING(
+          self, LIBRARY, SETTINGS, (NULL),
+          ("Failed to rebuild encoder, keeping current settings"));
     }
-    self->rtcp_interface_activated = TRUE;
-    GST_INFO_OBJECT(self, "RTCP control interface activated");
+    return;
   }
 
-  GST_INFO_OBJECT(self, "ROC encoder successfully initialized");
+  gst_rocsend_prepare_rebase(self);
+
+  g_mutex_lock(&self->encoder_lock);
+  roc_sender_encoder *old = self->encoder;
+  self->encoder = encoder;
+  g_mutex_unlock(&self->encoder_lock);
+  roc_sender_encoder_close(old);
+
+  self->encoder_config = self->rebuild_config;
+  self->config_state.channel_layout =
+      self->encoder_config.frame_encoding.channels;
+  self->config_state.tracks = self->encoder_config.frame_encoding.tracks;
+  if (self->mixer)
+    gst_audio_channel_mixer_free(self->mixer);
+  self->mixer = self->rebuild_mixer;
+  self->rebuild_mixer = NULL;
+  self->frame_channels = self->rebuild_channels;
+
+  GST_INFO_OBJECT(self, "Switched to rebuilt encoder");
+}
+
+/* Pick up property changes at a buffer boundary. Changes ROC can't apply
+ * to a running encoder are carried out by rebuilding it */
+static void gst_rocsend_update_settings(GstRocSend *self) {
+  if (self->rebuild_thread && g_atomic_int_get(&self->rebuild_done))
+    gst_rocsend_finish_rebuild(self, TRUE);
+
+  gst_rocsend_take_settings(self);
+
+  if (self->encoder && !self->rebuild_thread &&
+      (self->active.packet_encoding != self->encoder_config.packet_encoding ||
+       self->active.packet_length != self->encoder_config.packet_length))
+    gst_rocsend_start_rebuild(self);
+}
+
+/* Start capturing packets if dump-location is set */
+static gboolean gst_rocsend_open_dump(GstRocSend *self) {
+  GError *error = NULL;
+
+  GST_OBJECT_LOCK(self);
+  gchar *location = g_strdup(self->dump_location);
+  const guint64 rotate_size = self->dump_rotate_size;
+  GST_OBJECT_UNLOCK(self);
+
+  if (!location || !*location) {
+    g_free(location);
+    return TRUE;
+  }
+
+  GstRocPcapWriter *dump =
+      gst_roc_pcap_writer_new(location, rotate_size, &error);
+  if (!dump) {
+    GST_ELEMENT_ERROR(self, RESOURCE, OPEN_WRITE,
+                      ("Could not open packet capture file"),
+                      ("%s", error->message));
+    g_clear_error(&error);
+    g_free(location);
+    return FALSE;
+  }
+  g_atomic_pointer_set(&self->dump, dump);
+  GST_INFO_OBJECT(self, "Capturing packets to %s", location);
+  g_free(location);
   return TRUE;
 }
 
+/* Only state changes set the writer, but packets may still be captured from
+ * the RTCP sink pad: take the writer away and wait until no one uses it */
+static void gst_rocsend_close_dump(GstRocSend *self) {
+  GstRocPcapWriter *dump = g_atomic_pointer_get(&self->dump);
+  if (!dump)
+    return;
+  g_atomic_pointer_set(&self->dump, NULL);
+  while (g_atomic_int_get(&self->dump_users) > 0)
+    g_thread_yield();
+
+  const guint64 dropped = gst_roc_pcap_writer_get_dropped(dump);
+  if (dropped > 0)
+    GST_WARNING_OBJECT(self,
+                       "Packet capture dropped %" G_GUINT64_FORMAT " packets",
+                       dropped);
+  gst_roc_pcap_writer_free(dump);
+}
+
 static GstStateChangeReturn
 gst_rocsend_change_state(GstElement *element, GstStateChange transition) {
   const char *transition_name = "UNKNOWN";
@@ -724,12 +3185,54 @@ gst_rocsend_change_state(GstElement *element, GstStateChange transition) {
                  transition, transition_name);
   GstRocSend *self = GST_ROCSEND(element);
 
+  /* Handle pre-transition actions */
+  switch (transition) {
+  case GST_STATE_CHANGE_NULL_TO_READY:
+    /* Open the context (and optionally the encoder) ahead of PLAYING so the
+     * first buffer does not pay for their setup */
+    if (!gst_rocsend_open_context(self))
+      return GST_STATE_CHANGE_FAILURE;
+    if (!gst_rocsend_prewarm(self))
+      return GST_STATE_CHANGE_FAILURE;
+    break;
+  case GST_STATE_CHANGE_READY_TO_PAUSED:
+    g_mutex_lock(&self->rtx_lock);
+    gst_rocsend_history_resize_locked(self);
+    g_mutex_unlock(&self->rtx_lock);
+    if (!gst_buffer_pool_set_active(self->packet_pool, TRUE)) {
+      GST_ERROR_OBJECT(self, "Failed to activate packet buffer pool");
+      return GST_STATE_CHANGE_FAILURE;
+    }
+    if (!gst_rocsend_open_dump(self)) {
+      gst_buffer_pool_set_active(self->packet_pool, FALSE);
+      return GST_STATE_CHANGE_FAILURE;
+    }
+    GST_OBJECT_LOCK(self);
+    self->handoff_active = self->feedback_handoff;
+    GST_OBJECT_UNLOCK(self);
+    if (self->handoff_active && !self->feedback_slots)
+      self->feedback_slots =
+          g_new(GstRocSendFeedbackSlot, FEEDBACK_QUEUE_SIZE);
+    self->feedback_head = 0;
+    self->feedback_tail = 0;
+    break;
+  default:
+    break;
+  }
+
   /* Let parent class handle the state change first */
   GstStateChangeReturn ret = GST_ELEMENT_CLASS(gst_rocsend_parent_class)
                                  ->change_state(element, transition);
 
-  /* If parent state change failed, return immediately */
+  /* If parent state change failed, undo the streaming setup above and
+   * return immediately */
   if (ret == GST_STATE_CHANGE_FAILURE) {
+    if (transition == GST_STATE_CHANGE_READY_TO_PAUSED) {
+      gst_buffer_pool_set_active(self->packet_pool, FALSE);
+      gst_rocsend_close_dump(self);
+      self->handoff_active = FALSE;
+      g_clear_pointer(&self->feedback_slots, g_free);
+    }
     return ret;
   }
 
@@ -746,15 +3249,51 @@ gst_rocsend_change_state(GstElement *element, GstStateChange transition) {
     break;
 
   case GST_STATE_CHANGE_PAUSED_TO_READY:
+    self->last_dts = self->last_pts = GST_CLOCK_TIME_NONE;
+    self->prev_timestamp_valid = FALSE;
+    self->silence_duration = 0;
+    self->since_keepalive = 0;
+    self->talkspurt_start = FALSE;
+    g_mutex_lock(&self->rtx_lock);
+    gst_rocsend_history_clear_locked(self);
+    /* Deactivating the pad dropped the sticky events */
+    self->rtx_started = FALSE;
+    g_mutex_unlock(&self->rtx_lock);
+    gst_rocsend_finish_rebuild(self, FALSE);
+    gst_rocsend_reset_stream(self);
+    gst_segment_init(&self->segment, GST_FORMAT_UNDEFINED);
+    gst_rocsend_reset_qos(self);
+    GST_OBJECT_LOCK(self);
+    self->latency = GST_CLOCK_TIME_NONE;
+    GST_OBJECT_UNLOCK(self);
+    gst_rocsend_drift_reset(self);
+    gst_buffer_pool_set_active(self->packet_pool, FALSE);
+    gst_rocsend_close_dump(self);
+    self->handoff_active = FALSE;
+    g_clear_pointer(&self->feedback_slots, g_free);
+    GST_OBJECT_LOCK(self);
+    if (self->keep_encoder_on_stop) {
+      GST_OBJECT_UNLOCK(self);
+      GST_LOG_OBJECT(self,
+                     "Post-transition: PAUSED_TO_READY - keeping encoder");
+      break;
+    }
+    GST_OBJECT_UNLOCK(self);
     GST_LOG_OBJECT(self,
                    "Post-transition: PAUSED_TO_READY - cleaning up encoder");
     /* Clean up encoder when going back to READY */
-    if (self->encoder) {
-      roc_sender_encoder_close(self->encoder);
-      self->encoder = NULL;
-      self->encoder_activated = FALSE;
-      self->rtcp_interface_activated = FALSE;
-      GST_INFO_OBJECT(self, "ROC encoder closed");
+    gst_rocsend_close_encoder(self);
+    /* Build a fresh one right away so the next start is warm too */
+    if (!gst_rocsend_prewarm(self))
+      ret = GST_STATE_CHANGE_FAILURE;
+    break;
+
+  case GST_STATE_CHANGE_READY_TO_NULL:
+    GST_LOG_OBJECT(self, "Post-transition: READY_TO_NULL - closing context");
+    gst_rocsend_close_encoder(self);
+    if (self->context) {
+      roc_context_close(self->context);
+      self->context = NULL;
     }
     break;
 
@@ -781,12 +3320,165 @@ static void gst_rocsend_class_init(GstRocSendClass *klass) {
       gobject_class, PROP_PACKET_ENCODING,
       g_param_spec_uint("packet-encoding", "Packet Encoding",
                         "ROC packet encoding (0=auto)", 0, G_MAXUINT, 0,
-                        G_PARAM_READWRITE));
+                        G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
   g_object_class_install_property(
       gobject_class, PROP_PACKET_LENGTH,
       g_param_spec_uint64("packet-length", "Packet Length",
                           "Packet length in nanoseconds (0=default)", 0,
-                          G_MAXUINT64, 0, G_PARAM_READWRITE));
+                          G_MAXUINT64, 0,
+                          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_PREWARM_CAPS,
+      g_param_spec_boxed("prewarm-caps", "Prewarm Caps",
+                         "Fixed audio caps to build the encoder with in READY, "
+                         "before any data arrives (NULL=build on first CAPS)",
+                         GST_TYPE_CAPS, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_KEEP_ENCODER_ON_STOP,
+      g_param_spec_boolean("keep-encoder-on-stop", "Keep Encoder On Stop",
+                           "Reuse the encoder across READY/PAUSED cycles "
+                           "instead of closing it on PAUSED_TO_READY",
+                           FALSE, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_MIX_MATRIX,
+      gst_param_spec_array(
+          "mix-matrix", "Input/output channel matrix",
+          "Transformation matrix applied before encoding, one row per "
+          "encoded channel (empty=automatic downmix, see downmix)",
+          gst_param_spec_array("matrix-rows", "rows", "rows",
+                               g_param_spec_float("matrix-cols", "cols",
+                                                  "cols", -1, 1, 0,
+                                                  G_PARAM_READWRITE),
+                               G_PARAM_READWRITE),
+          G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_DOWNMIX,
+      g_param_spec_boolean("downmix", "Downmix",
+                           "Downmix using the caps channel positions when "
+                           "the caps carry more channels than the packet "
+                           "encoding",
+                           TRUE, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_DTX,
+      g_param_spec_boolean("dtx", "DTX",
+                           "Discontinuous transmission: stop sending packets "
+                           "(except keepalives) during silence",
+                           DEFAULT_DTX,
+                           G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_DTX_THRESHOLD,
+      g_param_spec_double("dtx-threshold", "DTX Threshold",
+                          "Peak level below which input counts as silence "
+                          "(dBFS)",
+                          -200.0, 0.0, DEFAULT_DTX_THRESHOLD,
+                          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_DTX_HANGOVER,
+      g_param_spec_uint64("dtx-hangover", "DTX Hangover",
+                          "Silence in nanoseconds before packets are "
+                          "suppressed",
+                          0, G_MAXUINT64, DEFAULT_DTX_HANGOVER,
+                          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_DTX_KEEPALIVE,
+      g_param_spec_uint64("dtx-keepalive", "DTX Keepalive",
+                          "Interval in nanoseconds between keepalive packets "
+                          "while suppressing",
+                          0, G_MAXUINT64, DEFAULT_DTX_KEEPALIVE,
+                          G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_RTX_HISTORY_SIZE,
+      g_param_spec_uint("rtx-history-size", "RTX History Size",
+                        "Number of sent packets kept for NACK-driven "
+                        "retransmission (0=disabled)",
+                        0, G_MAXUINT16, DEFAULT_RTX_HISTORY_SIZE,
+                        G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_RTX_HISTORY_MAX_BYTES,
+      g_param_spec_uint64("rtx-history-max-bytes", "RTX History Max Bytes",
+                          "Maximum bytes held in the retransmission history "
+                          "(0=unlimited)",
+                          0, G_MAXUINT64, DEFAULT_RTX_HISTORY_MAX_BYTES,
+                          G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_RTX_PAYLOAD_TYPE,
+      g_param_spec_uint("rtx-payload-type", "RTX Payload Type",
+                        "Payload type of RFC 4588 retransmission packets",
+                        96, 127, DEFAULT_RTX_PAYLOAD_TYPE,
+                        G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_MAX_LATENESS,
+      g_param_spec_int64("max-lateness", "Max Lateness",
+                         "Input later than this (in nanoseconds) against the "
+                         "pipeline clock or downstream QoS is not sent "
+                         "(-1=send everything)",
+                         -1, G_MAXINT64, DEFAULT_MAX_LATENESS,
+                         G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_LATE_POLICY,
+      g_param_spec_enum("late-policy", "Late Policy",
+                        "What to do with input later than max-lateness",
+                        GST_TYPE_ROCSEND_LATE_POLICY, DEFAULT_LATE_POLICY,
+                        G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_DRIFT_COMPENSATION,
+      g_param_spec_boolean("drift-compensation", "Drift Compensation",
+                           "Measure the input rate against the pipeline clock "
+                           "and resample so packets carry the nominal rate",
+                           DEFAULT_DRIFT_COMPENSATION,
+                           G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_DRIFT_PPM,
+      g_param_spec_double("drift-ppm", "Drift PPM",
+                          "Measured input rate deviation from nominal, in "
+                          "parts per million",
+                          -G_MAXDOUBLE, G_MAXDOUBLE, 0, G_PARAM_READABLE));
+  g_object_class_install_property(
+      gobject_class, PROP_PACING,
+      g_param_spec_boolean("pacing", "Pacing",
+                           "Release RTP packets one packet duration apart on "
+                           "the pipeline clock instead of in bursts. Takes "
+                           "effect when the src pad is activated",
+                           DEFAULT_PACING,
+                           G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property(
+      gobject_class, PROP_MAX_BURST,
+      g_param_spec_uint("max-burst", "Max Burst",
+                        "Packets pacing may release back to back after idle "
+                        "time",
+                        1, PACING_QUEUE_SIZE, DEFAULT_MAX_BURST,
+                        G_PARAM_READWRITE | GST_PARAM_MUTABLE_PLAYING));
+  g_object_class_install_property(
+      gobject_class, PROP_USE_PIPELINE_CLOCK,
+      g_param_spec_boolean("use-pipeline-clock", "Use Pipeline Clock",
+                           "Start RTP timestamps at the pipeline clock time "
+                           "of capture and send it as NTP time in sender "
+                           "reports, so senders sharing a clock line up",
+                           DEFAULT_USE_PIPELINE_CLOCK, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_DUMP_LOCATION,
+      g_param_spec_string("dump-location", "Dump Location",
+                          "Capture sent RTP/RTCP and received feedback "
+                          "packets to this pcap file, NULL disables",
+                          NULL, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_DUMP_ROTATE_SIZE,
+      g_param_spec_uint64("dump-rotate-size", "Dump Rotate Size",
+                          "Size in bytes at which the capture file is moved "
+                          "to <dump-location>.1 and restarted, 0 disables",
+                          0, G_MAXUINT64, DEFAULT_DUMP_ROTATE_SIZE,
+                          G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_FEEDBACK_HANDOFF,
+      g_param_spec_boolean("feedback-handoff", "Feedback Handoff",
+                           "Queue RTCP feedback for the audio streaming "
+                           "thread to apply, instead of pushing it to the "
+                           "encoder from the feedback thread",
+                           DEFAULT_FEEDBACK_HANDOFF, G_PARAM_READWRITE));
+  g_object_class_install_property(
+      gobject_class, PROP_STATS,
+      g_param_spec_boxed("stats", "Statistics", "Sender statistics",
+                         GST_TYPE_STRUCTURE, G_PARAM_READABLE));
 
   GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
   gst_element_class_set_static_metadata(element_class, "ROC Sender",
@@ -802,7 +3494,8 @@ static void gst_rocsend_class_init(GstRocSendClass *klass) {
                               GST_STATIC_CAPS("audio/x-raw, "
                                               "format = (string) F32LE, "
                                               "rate = (int) [ 1, MAX ], "
-                                              "layout = (string) interleaved, "
+                                              "layout = (string) { interleaved, "
+                                              "non-interleaved }, "
                                               "channels = (int) [ 1, MAX ]"));
   gst_element_class_add_pad_template(
       element_class, gst_static_pad_template_get(&sink_template));
@@ -818,10 +3511,14 @@ static void gst_rocsend_class_init(GstRocSendClass *klass) {
       element_class, gst_static_pad_template_get(&rtcp_src_factory));
   gst_element_class_add_pad_template(
       element_class, gst_static_pad_template_get(&rtcp_sink_factory));
+  gst_element_class_add_pad_template(
+      element_class, gst_static_pad_template_get(&rtx_src_factory));
   element_class->request_new_pad = gst_rocsend_request_new_pad;
   element_class->release_pad = gst_rocsend_release_pad;
 
   element_class->change_state = GST_DEBUG_FUNCPTR(gst_rocsend_change_state);
+
+  gst_type_mark_as_plugin_api(GST_TYPE_ROCSEND_LATE_POLICY, 0);
 }
 
 static void gst_rocsend_init(GstRocSend *self) {
@@ -834,6 +3531,8 @@ static void gst_rocsend_init(GstRocSend *self) {
                              GST_DEBUG_FUNCPTR(gst_rocsend_chain));
   gst_pad_set_event_function(self->sinkpad,
                              GST_DEBUG_FUNCPTR(gst_rocsend_sink_event));
+  gst_pad_set_query_function(self->sinkpad,
+                             GST_DEBUG_FUNCPTR(gst_rocsend_sink_query));
   gst_element_add_pad(GST_ELEMENT(self), self->sinkpad);
 
   // Create RTP source pad (always)
@@ -841,6 +3540,10 @@ static void gst_rocsend_init(GstRocSend *self) {
       gst_element_class_get_pad_template(
           GST_ELEMENT_CLASS(G_OBJECT_GET_CLASS(self)), "src"),
       "src");
+  gst_pad_set_event_function(self->srcpad,
+                             GST_DEBUG_FUNCPTR(gst_rocsend_src_event));
+  gst_pad_set_activatemode_function(
+      self->srcpad, GST_DEBUG_FUNCPTR(gst_rocsend_src_activate_mode));
   gst_element_add_pad(GST_ELEMENT(self), self->srcpad);
 
   // Initialize ROC components
@@ -851,6 +3554,7 @@ static void gst_rocsend_init(GstRocSend *self) {
   // Initialize RTCP pads and state
   self->rtcp_src_pad = NULL;
   self->rtcp_sink_pad = NULL;
+  self->rtx_src_pad = NULL;
   self->rtcp_interface_activated = FALSE;
 
   // Initialize configuration state for deferred initialization
@@ -861,10 +3565,25 @@ static void gst_rocsend_init(GstRocSend *self) {
 
   // Initialize state
   self->negotiated_caps = NULL;
+  gst_audio_info_init(&self->audio_info);
+  self->frame_buf = NULL;
+  self->frame_buf_size = 0;
+
+  self->packet_pool = gst_buffer_pool_new();
+  GstStructure *pool_config = gst_buffer_pool_get_config(self->packet_pool);
+  gst_buffer_pool_config_set_params(pool_config, NULL, PACKET_BUFFER_SIZE,
+                                    PACKET_POOL_MIN_BUFFERS, 0);
+  gst_buffer_pool_set_config(self->packet_pool, pool_config);
 
   // Initialize ROC configuration properties with defaults
-  self->packet_encoding = ROC_PACKET_ENCODING_AVP_L16_STEREO;
-  self->packet_length = 0;
+  self->settings.packet_encoding = ROC_PACKET_ENCODING_AVP_L16_STEREO;
+  self->settings.packet_length = 0;
+  self->prewarm_caps = NULL;
+  self->keep_encoder_on_stop = FALSE;
+  g_value_init(&self->mix_matrix, GST_TYPE_ARRAY);
+  self->downmix = TRUE;
+  self->mixer = NULL;
+  self->frame_channels = 0;
 
   self->last_dts = self->last_pts = GST_CLOCK_TIME_NONE;
 
@@ -872,14 +3591,113 @@ static void gst_rocsend_init(GstRocSend *self) {
   memset(&self->encoder_config, 0, sizeof(self->encoder_config));
   self->prev_timestamp = 0;
   self->prev_timestamp_valid = FALSE;
+
+  self->settings.dtx = DEFAULT_DTX;
+  self->settings.dtx_threshold = DEFAULT_DTX_THRESHOLD;
+  self->settings.dtx_hangover = DEFAULT_DTX_HANGOVER;
+  self->settings.dtx_keepalive = DEFAULT_DTX_KEEPALIVE;
+  self->settings.max_lateness = DEFAULT_MAX_LATENESS;
+  self->settings.late_policy = DEFAULT_LATE_POLICY;
+  self->settings.drift_compensation = DEFAULT_DRIFT_COMPENSATION;
+  self->active = self->settings;
+  self->pending_settings = NULL;
+
+  gst_segment_init(&self->segment, GST_FORMAT_UNDEFINED);
+  self->earliest_time = GST_CLOCK_TIME_NONE;
+  self->proportion = 1.0;
+  self->latency = GST_CLOCK_TIME_NONE;
+  self->buffers_processed = 0;
+  self->buffers_late = 0;
+  self->late_duration = 0;
+
+  self->resampler = NULL;
+  self->resampler_channels = 0;
+  self->resample_buf = NULL;
+  self->resample_buf_size = 0;
+  self->drift_anchor = GST_CLOCK_TIME_NONE;
+  self->drift_ratio = 0;
+  self->drift_ppm = 0;
+
+  self->feedback_handoff = DEFAULT_FEEDBACK_HANDOFF;
+  self->handoff_active = FALSE;
+  self->feedback_slots = NULL;
+  self->feedback_head = 0;
+  self->feedback_tail = 0;
+  self->feedback_dropped = 0;
+  self->feedback_applied = 0;
+
+  self->dump_location = NULL;
+  self->dump_rotate_size = DEFAULT_DUMP_ROTATE_SIZE;
+  self->dump = NULL;
+  self->dump_users = 0;
+
+  self->pacing = DEFAULT_PACING;
+  self->max_burst = DEFAULT_MAX_BURST;
+  self->pacing_active = FALSE;
+  g_mutex_init(&self->pace_lock);
+  g_cond_init(&self->pace_cond);
+  memset(self->pace_queue, 0, sizeof(self->pace_queue));
+  self->pace_head = 0;
+  self->pace_len = 0;
+  self->pace_flushing = TRUE;
+  self->pace_flow = GST_FLOW_OK;
+  self->pace_clock_id = NULL;
+  self->pace_time = GST_CLOCK_TIME_NONE;
+
+  g_mutex_init(&self->encoder_lock);
+  self->rebuild_thread = NULL;
+  self->rebuild_done = 0;
+  self->rebuild_encoder = NULL;
+  self->rebuild_mixer = NULL;
+  self->rebuild_channels = 0;
+
+  self->seq_offset = 0;
+  self->ts_offset = 0;
+  self->out_ssrc_valid = FALSE;
+  self->enc_ssrc_valid = FALSE;
+  self->rebase_pending = FALSE;
+  self->frames_pushed = 0;
+  self->frames_emitted = 0;
+  self->sent_packets = 0;
+  self->sent_octets = 0;
+  self->sr_packet_offset = 0;
+  self->sr_octet_offset = 0;
+  self->use_pipeline_clock = DEFAULT_USE_PIPELINE_CLOCK;
+  self->clock_timebase = FALSE;
+  self->sync_rtp_ts = 0;
+  self->sync_clock_time = GST_CLOCK_TIME_NONE;
+  self->silence_duration = 0;
+  self->since_keepalive = 0;
+  self->talkspurt_start = FALSE;
+  self->packets_sent = 0;
+  self->packets_suppressed = 0;
+
+  self->rtx_history_size = DEFAULT_RTX_HISTORY_SIZE;
+  self->rtx_history_max_bytes = DEFAULT_RTX_HISTORY_MAX_BYTES;
+  self->rtx_payload_type = DEFAULT_RTX_PAYLOAD_TYPE;
+  g_mutex_init(&self->rtx_lock);
+  self->rtx_history = NULL;
+  self->rtx_history_len = 0;
+  self->rtx_history_bytes = 0;
+  self->rtx_history_valid = FALSE;
+  self->media_ssrc_valid = FALSE;
+  self->rtx_ssrc = g_random_int();
+  self->rtx_seq = g_random_int_range(0, G_MAXUINT16);
+  self->rtx_started = FALSE;
+  self->nacks_received = 0;
+  self->packets_retransmitted = 0;
+  self->retransmissions_missed = 0;
 }
 
 static gboolean plugin_init(GstPlugin *plugin) {
   GST_DEBUG_CATEGORY_INIT(gst_rocsend_debug, "rocsend", 0, "ROC Sender");
   GST_DEBUG_CATEGORY_INIT(roc_toolkit_debug, "roctoolkit", 0, "ROC Toolkit");
 
-  return gst_element_register(plugin, "rocsend", GST_RANK_NONE,
-                              GST_TYPE_ROCSEND);
+  if (!gst_element_register(plugin, "rocsend", GST_RANK_NONE,
+                            GST_TYPE_ROCSEND))
+    return FALSE;
+
+  return gst_rocsend_tracer_register(plugin);
 }
 
 #ifndef PACKAGE
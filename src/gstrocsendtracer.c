@@ -0,0 +1,239 @@
+/* rocsend tracer: per-element histograms of capture-to-push latency and
+ * ROC encoder call durations, dumped to CSV at teardown.
+ *
+ *   GST_TRACERS="rocsend(file=/tmp/rocsend.csv)" gst-launch-1.0 ...
+ */
+#include "gstrocsendtracer.h"
+
+#include <stdio.h>
+
+GST_DEBUG_CATEGORY_STATIC(gst_rocsend_tracer_debug);
+#define GST_CAT_DEFAULT gst_rocsend_tracer_debug
+
+#define DEFAULT_FILE "rocsend-trace.csv"
+/* log2(ns) buckets, enough for any GstClockTime */
+#define N_BUCKETS 64
+
+#define GST_TYPE_ROCSEND_TRACER (gst_rocsend_tracer_get_type())
+#define GST_ROCSEND_TRACER(obj)                                                \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_ROCSEND_TRACER, GstRocSendTracer))
+
+typedef struct _GstRocSendTracer GstRocSendTracer;
+typedef struct _GstRocSendTracerClass GstRocSendTracerClass;
+
+enum {
+  METRIC_CAPTURE_LATENCY = GST_ROCSEND_TRACE_N_OPS,
+  N_METRICS
+};
+
+static const gchar *metric_names[N_METRICS] = {
+    [GST_ROCSEND_TRACE_PUSH_FRAME] = "push-frame",
+    [GST_ROCSEND_TRACE_POP_PACKET] = "pop-packet",
+    [GST_ROCSEND_TRACE_POP_CONTROL] = "pop-control",
+    [GST_ROCSEND_TRACE_PUSH_FEEDBACK] = "push-feedback",
+    [METRIC_CAPTURE_LATENCY] = "capture-latency",
+};
+
+typedef struct {
+  gint ref_count;
+  gchar *element_name;
+  gint buckets[N_METRICS][N_BUCKETS];
+} ElementStats;
+
+struct _GstRocSendTracer {
+  GstTracer parent;
+
+  gchar *file;
+};
+
+struct _GstRocSendTracerClass {
+  GstTracerClass parent_class;
+};
+
+GType gst_rocsend_tracer_get_type(void);
+
+G_DEFINE_TYPE(GstRocSendTracer, gst_rocsend_tracer, GST_TYPE_TRACER)
+
+gint gst_rocsend_tracer_active = 0;
+
+/* Stats of every traced element, kept for the dump at teardown. Elements
+ * find theirs through qdata so recording takes no global lock; the element
+ * and all_stats each hold a ref */
+static GMutex stats_lock;
+static GPtrArray *all_stats;
+static GQuark stats_quark;
+static GType rocsend_type;
+
+static void element_stats_unref(gpointer data) {
+  ElementStats *stats = data;
+  if (g_atomic_int_dec_and_test(&stats->ref_count)) {
+    g_free(stats->element_name);
+    g_free(stats);
+  }
+}
+
+static ElementStats *get_element_stats(GstElement *element) {
+  ElementStats *stats = g_object_get_qdata(G_OBJECT(element), stats_quark);
+  if (G_LIKELY(stats))
+    return stats;
+
+  g_mutex_lock(&stats_lock);
+  stats = g_object_get_qdata(G_OBJECT(element), stats_quark);
+  if (!stats && all_stats) {
+    stats = g_new0(ElementStats, 1);
+    stats->ref_count = 2;
+    stats->element_name = gst_object_get_name(GST_OBJECT(element));
+    g_ptr_array_add(all_stats, stats);
+    g_object_set_qdata_full(G_OBJECT(element), stats_quark, stats,
+                            element_stats_unref);
+  }
+  g_mutex_unlock(&stats_lock);
+  return stats;
+}
+
+static void record(GstElement *element, guint metric, GstClockTime value) {
+  ElementStats *stats = get_element_stats(element);
+  if (!stats)
+    return;
+
+  const guint bucket = value ? MIN(g_bit_storage(value), N_BUCKETS - 1) : 0;
+  g_atomic_int_inc(&stats->buckets[metric][bucket]);
+}
+
+void gst_rocsend_tracer_record(GstElement *element, GstRocSendTraceOp op,
+                               GstClockTime duration) {
+  record(element, op, duration);
+}
+
+/* Capture-to-push latency of each RTP packet leaving a rocsend: pipeline
+ * clock running time now, against the running time of the packet PTS */
+static void do_push_buffer_pre(GstTracer *tracer, guint64 ts, GstPad *pad,
+                               GstBuffer *buffer) {
+  GstObject *parent = GST_OBJECT_PARENT(pad);
+  (void)tracer;
+  (void)ts;
+
+  if (!parent || !G_TYPE_CHECK_INSTANCE_TYPE(parent, rocsend_type) ||
+      GST_PAD_DIRECTION(pad) != GST_PAD_SRC ||
+      g_strcmp0(GST_PAD_NAME(pad), "src") != 0 ||
+      !GST_BUFFER_PTS_IS_VALID(buffer))
+    return;
+
+  GstElement *element = GST_ELEMENT(parent);
+  GstClock *clock = gst_element_get_clock(element);
+  if (!clock)
+    return;
+
+  GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+  if (event) {
+    const GstSegment *segment;
+    gst_event_parse_segment(event, &segment);
+    const GstClockTime running_time = gst_segment_to_running_time(
+        segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+    const GstClockTime now =
+        gst_clock_get_time(clock) - gst_element_get_base_time(element);
+    if (GST_CLOCK_TIME_IS_VALID(running_time) && now >= running_time)
+      record(element, METRIC_CAPTURE_LATENCY, now - running_time);
+    gst_event_unref(event);
+  }
+  gst_object_unref(clock);
+}
+
+static void dump_csv(GstRocSendTracer *self) {
+  FILE *f = fopen(self->file, "w");
+  if (!f) {
+    GST_WARNING_OBJECT(self, "Failed to open %s for writing", self->file);
+    return;
+  }
+
+  fprintf(f, "element,metric,bucket_low_ns,bucket_high_ns,count\n");
+  g_mutex_lock(&stats_lock);
+  for (guint i = 0; i < all_stats->len; i++) {
+    ElementStats *stats = g_ptr_array_index(all_stats, i);
+    for (guint m = 0; m < N_METRICS; m++) {
+      for (guint b = 0; b < N_BUCKETS; b++) {
+        const gint count = g_atomic_int_get(&stats->buckets[m][b]);
+        if (count == 0)
+          continue;
+        const guint64 low = b ? G_GUINT64_CONSTANT(1) << (b - 1) : 0;
+        const guint64 high = b ? (G_GUINT64_CONSTANT(1) << b) - 1 : 0;
+        fprintf(f, "%s,%s,%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%d\n",
+                stats->element_name, metric_names[m], low, high, count);
+      }
+    }
+  }
+  g_mutex_unlock(&stats_lock);
+
+  fclose(f);
+  GST_INFO_OBJECT(self, "Wrote rocsend histograms to %s", self->file);
+}
+
+static void gst_rocsend_tracer_constructed(GObject *object) {
+  GstRocSendTracer *self = GST_ROCSEND_TRACER(object);
+  gchar *params = NULL;
+
+  G_OBJECT_CLASS(gst_rocsend_tracer_parent_class)->constructed(object);
+
+  g_object_get(self, "params", &params, NULL);
+  if (params) {
+    gchar *desc = g_strdup_printf("rocsend,%s", params);
+    GstStructure *s = gst_structure_from_string(desc, NULL);
+    if (s) {
+      const gchar *file = gst_structure_get_string(s, "file");
+      if (file) {
+        g_free(self->file);
+        self->file = g_strdup(file);
+      }
+      gst_structure_free(s);
+    } else {
+      GST_WARNING_OBJECT(self, "Can't parse tracer params '%s'", params);
+    }
+    g_free(desc);
+    g_free(params);
+  }
+}
+
+static void gst_rocsend_tracer_finalize(GObject *object) {
+  GstRocSendTracer *self = GST_ROCSEND_TRACER(object);
+
+  g_atomic_int_add(&gst_rocsend_tracer_active, -1);
+  dump_csv(self);
+  g_free(self->file);
+
+  /* Elements still alive drop their stats when they go */
+  g_mutex_lock(&stats_lock);
+  if (all_stats && g_atomic_int_get(&gst_rocsend_tracer_active) == 0)
+    g_clear_pointer(&all_stats, g_ptr_array_unref);
+  g_mutex_unlock(&stats_lock);
+
+  G_OBJECT_CLASS(gst_rocsend_tracer_parent_class)->finalize(object);
+}
+
+static void gst_rocsend_tracer_class_init(GstRocSendTracerClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+  gobject_class->constructed = gst_rocsend_tracer_constructed;
+  gobject_class->finalize = gst_rocsend_tracer_finalize;
+
+  stats_quark = g_quark_from_static_string("gst-rocsend-tracer-stats");
+}
+
+static void gst_rocsend_tracer_init(GstRocSendTracer *self) {
+  self->file = g_strdup(DEFAULT_FILE);
+  rocsend_type = g_type_from_name("GstRocSend");
+
+  g_mutex_lock(&stats_lock);
+  if (!all_stats)
+    all_stats = g_ptr_array_new_with_free_func(element_stats_unref);
+  g_mutex_unlock(&stats_lock);
+  g_atomic_int_inc(&gst_rocsend_tracer_active);
+
+  gst_tracing_register_hook(GST_TRACER(self), "pad-push-pre",
+                            G_CALLBACK(do_push_buffer_pre));
+}
+
+gboolean gst_rocsend_tracer_register(GstPlugin *plugin) {
+  GST_DEBUG_CATEGORY_INIT(gst_rocsend_tracer_debug, "rocsendtracer", 0,
+                          "ROC Sender tracer");
+  return gst_tracer_register(plugin, "rocsend", GST_TYPE_ROCSEND_TRACER);
+}
@@ -0,0 +1,38 @@
+#ifndef GSTROCSENDTRACER_H__
+#define GSTROCSENDTRACER_H__
+
+#include <gst/gst.h>
+
+/* Encoder calls timed by the rocsend tracer */
+typedef enum {
+  GST_ROCSEND_TRACE_PUSH_FRAME,
+  GST_ROCSEND_TRACE_POP_PACKET,
+  GST_ROCSEND_TRACE_POP_CONTROL,
+  GST_ROCSEND_TRACE_PUSH_FEEDBACK,
+  GST_ROCSEND_TRACE_N_OPS
+} GstRocSendTraceOp;
+
+/* Number of live rocsend tracer instances */
+extern gint gst_rocsend_tracer_active;
+
+void gst_rocsend_tracer_record(GstElement *element, GstRocSendTraceOp op,
+                               GstClockTime duration);
+
+gboolean gst_rocsend_tracer_register(GstPlugin *plugin);
+
+/* Returns a start timestamp when a tracer is active, NONE otherwise, so the
+ * untraced hot path costs one atomic load */
+static inline GstClockTime gst_rocsend_trace_begin(void) {
+  return G_UNLIKELY(g_atomic_int_get(&gst_rocsend_tracer_active) > 0)
+             ? gst_util_get_timestamp()
+             : GST_CLOCK_TIME_NONE;
+}
+
+static inline void gst_rocsend_trace_end(GstElement *element,
+                                         GstRocSendTraceOp op,
+                                         GstClockTime start) {
+  if (G_UNLIKELY(GST_CLOCK_TIME_IS_VALID(start)))
+    gst_rocsend_tracer_record(element, op, gst_util_get_timestamp() - start);
+}
+
+#endif /* GSTROCSENDTRACER_H__ */
@@ -0,0 +1,288 @@
+#include "pcapwriter.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+GST_DEBUG_CATEGORY_STATIC(gst_roc_pcap_debug);
+#define GST_CAT_DEFAULT gst_roc_pcap_debug
+
+/* Each of the two capture buffers, one filled while the other is written */
+#define PCAP_BUFFER_SIZE (1024 * 1024)
+/* A partly filled buffer is written out after this long */
+#define PCAP_FLUSH_INTERVAL G_TIME_SPAN_SECOND
+
+/* pcap with nanosecond timestamps, raw IPv4 packets */
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+#define PCAP_SNAPLEN 65535
+#define PCAP_LINKTYPE_RAW 101
+#define PCAP_FILE_HEADER_SIZE 24
+#define PCAP_RECORD_HEADER_SIZE 16
+#define IPV4_HEADER_SIZE 20
+#define UDP_HEADER_SIZE 8
+#define PACKET_OVERHEAD                                                        \
+  (PCAP_RECORD_HEADER_SIZE + IPV4_HEADER_SIZE + UDP_HEADER_SIZE)
+
+/* Synthetic endpoints: the sender is 10.0.0.1, receivers 10.0.0.2 */
+#define SENDER_ADDR 0x0a000001
+#define RECEIVER_ADDR 0x0a000002
+
+static const guint16 flow_ports[] = {
+    [GST_ROC_PCAP_RTP] = 5004,
+    [GST_ROC_PCAP_RTCP] = 5005,
+    [GST_ROC_PCAP_FEEDBACK] = 5005,
+    [GST_ROC_PCAP_RTX] = 5006,
+};
+
+struct _GstRocPcapWriter {
+  gchar *location;
+  guint64 rotate_size;
+
+  /* Flush thread only */
+  FILE *file;
+  guint64 file_size;
+  gboolean failed;
+
+  GMutex lock;
+  GCond cond;
+  guint8 *buffers[2];
+  gsize fill[2];
+  guint active;     /* buffer being filled */
+  gboolean pending; /* the other buffer waits to be written */
+  gboolean running;
+  guint64 dropped;
+  GThread *thread;
+};
+
+static FILE *open_file(const gchar *location, GError **error) {
+  FILE *file = g_fopen(location, "wb");
+  if (!file) {
+    const int err = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(err),
+                "Can't open %s: %s", location, g_strerror(err));
+    return NULL;
+  }
+
+  guint8 header[PCAP_FILE_HEADER_SIZE];
+  const guint32 magic = PCAP_MAGIC_NSEC;
+  const guint16 version[2] = {2, 4};
+  const guint32 fields[4] = {0, 0, PCAP_SNAPLEN, PCAP_LINKTYPE_RAW};
+  memcpy(header, &magic, 4);
+  memcpy(header + 4, version, 4);
+  memcpy(header + 8, fields, 16);
+  if (fwrite(header, sizeof(header), 1, file) != 1) {
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_IO,
+                "Can't write pcap header to %s", location);
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+/* Move the full file aside and start a new one */
+static void rotate(GstRocPcapWriter *writer) {
+  GError *error = NULL;
+  gchar *old = g_strconcat(writer->location, ".1", NULL);
+
+  fclose(writer->file);
+  writer->file = NULL;
+  if (g_rename(writer->location, old) != 0)
+    GST_WARNING("Can't move %s to %s: %s", writer->location, old,
+                g_strerror(errno));
+  g_free(old);
+
+  writer->file = open_file(writer->location, &error);
+  writer->file_size = PCAP_FILE_HEADER_SIZE;
+  if (!writer->file) {
+    GST_WARNING("Stopping packet capture: %s", error->message);
+    g_clear_error(&error);
+    writer->failed = TRUE;
+  }
+}
+
+static void write_records(GstRocPcapWriter *writer, const guint8 *data,
+                          gsize size) {
+  gsize offset = 0;
+
+  while (offset < size && !writer->failed) {
+    guint32 incl_len;
+    memcpy(&incl_len, data + offset + 8, 4);
+    const gsize len = PCAP_RECORD_HEADER_SIZE + incl_len;
+
+    /* Rotate at record boundaries, a file always holds whole records */
+    if (writer->rotate_size > 0 &&
+        writer->file_size > PCAP_FILE_HEADER_SIZE &&
+        writer->file_size + len > writer->rotate_size) {
+      rotate(writer);
+      if (writer->failed)
+        break;
+    }
+
+    if (fwrite(data + offset, len, 1, writer->file) != 1) {
+      GST_WARNING("Stopping packet capture: can't write to %s",
+                  writer->location);
+      writer->failed = TRUE;
+      break;
+    }
+    writer->file_size += len;
+    offset += len;
+  }
+  if (writer->file)
+    fflush(writer->file);
+}
+
+static gpointer flush_func(gpointer data) {
+  GstRocPcapWriter *writer = data;
+
+  g_mutex_lock(&writer->lock);
+  for (;;) {
+    if (!writer->pending && writer->running) {
+      const gint64 deadline = g_get_monotonic_time() + PCAP_FLUSH_INTERVAL;
+      while (!writer->pending && writer->running)
+        if (!g_cond_wait_until(&writer->cond, &writer->lock, deadline))
+          break;
+    }
+    /* Nothing full yet: write out what there is on timeout or stop */
+    if (!writer->pending && writer->fill[writer->active] > 0) {
+      writer->active ^= 1;
+      writer->pending = TRUE;
+    }
+    if (!writer->pending) {
+      if (!writer->running)
+        break;
+      continue;
+    }
+
+    const guint idx = writer->active ^ 1;
+    g_mutex_unlock(&writer->lock);
+    write_records(writer, writer->buffers[idx], writer->fill[idx]);
+    g_mutex_lock(&writer->lock);
+    writer->fill[idx] = 0;
+    writer->pending = FALSE;
+  }
+  g_mutex_unlock(&writer->lock);
+  return NULL;
+}
+
+GstRocPcapWriter *gst_roc_pcap_writer_new(const gchar *location,
+                                          guint64 rotate_size,
+                                          GError **error) {
+  if (!gst_roc_pcap_debug)
+    GST_DEBUG_CATEGORY_INIT(gst_roc_pcap_debug, "rocsendpcap", 0,
+                            "ROC Sender packet capture");
+
+  FILE *file = open_file(location, error);
+  if (!file)
+    return NULL;
+
+  GstRocPcapWriter *writer = g_new0(GstRocPcapWriter, 1);
+  writer->location = g_strdup(location);
+  writer->rotate_size = rotate_size;
+  writer->file = file;
+  writer->file_size = PCAP_FILE_HEADER_SIZE;
+  g_mutex_init(&writer->lock);
+  g_cond_init(&writer->cond);
+  writer->buffers[0] = g_malloc(PCAP_BUFFER_SIZE);
+  writer->buffers[1] = g_malloc(PCAP_BUFFER_SIZE);
+  writer->running = TRUE;
+
+  writer->thread =
+      g_thread_try_new("rocsend-pcap", flush_func, writer, error);
+  if (!writer->thread) {
+    writer->running = FALSE;
+    gst_roc_pcap_writer_free(writer);
+    return NULL;
+  }
+  return writer;
+}
+
+static guint16 ipv4_checksum(const guint8 *header) {
+  guint32 sum = 0;
+  for (guint i = 0; i < IPV4_HEADER_SIZE; i += 2)
+    sum += GST_READ_UINT16_BE(header + i);
+  while (sum >> 16)
+    sum = (sum & 0xffff) + (sum >> 16);
+  return ~sum;
+}
+
+void gst_roc_pcap_writer_write(GstRocPcapWriter *writer, GstClockTime time,
+                               GstRocPcapFlow flow, const guint8 *data,
+                               gsize size) {
+  const gsize len = PACKET_OVERHEAD + size;
+  if (size > PCAP_SNAPLEN - IPV4_HEADER_SIZE - UDP_HEADER_SIZE)
+    return;
+
+  /* Headers are built before taking the lock, under it packets are only
+   * copied in */
+  guint8 headers[PACKET_OVERHEAD];
+  const guint32 record[4] = {
+      (guint32)(time / GST_SECOND),
+      (guint32)(time % GST_SECOND),
+      (guint32)(len - PCAP_RECORD_HEADER_SIZE),
+      (guint32)(len - PCAP_RECORD_HEADER_SIZE),
+  };
+  memcpy(headers, record, PCAP_RECORD_HEADER_SIZE);
+
+  const gboolean incoming = flow == GST_ROC_PCAP_FEEDBACK;
+  guint8 *ip = headers + PCAP_RECORD_HEADER_SIZE;
+  memset(ip, 0, IPV4_HEADER_SIZE);
+  ip[0] = 0x45; /* IPv4, 5 words of header */
+  GST_WRITE_UINT16_BE(ip + 2, len - PCAP_RECORD_HEADER_SIZE);
+  ip[8] = 64; /* TTL */
+  ip[9] = 17; /* UDP */
+  GST_WRITE_UINT32_BE(ip + 12, incoming ? RECEIVER_ADDR : SENDER_ADDR);
+  GST_WRITE_UINT32_BE(ip + 16, incoming ? SENDER_ADDR : RECEIVER_ADDR);
+  GST_WRITE_UINT16_BE(ip + 10, ipv4_checksum(ip));
+
+  /* Zero UDP checksum: not computed */
+  guint8 *udp = ip + IPV4_HEADER_SIZE;
+  GST_WRITE_UINT16_BE(udp, flow_ports[flow]);
+  GST_WRITE_UINT16_BE(udp + 2, flow_ports[flow]);
+  GST_WRITE_UINT16_BE(udp + 4, UDP_HEADER_SIZE + size);
+  GST_WRITE_UINT16_BE(udp + 6, 0);
+
+  g_mutex_lock(&writer->lock);
+  if (writer->fill[writer->active] + len > PCAP_BUFFER_SIZE) {
+    if (writer->pending) {
+      writer->dropped++;
+      g_mutex_unlock(&writer->lock);
+      return;
+    }
+    writer->active ^= 1;
+    writer->pending = TRUE;
+    g_cond_signal(&writer->cond);
+  }
+
+  guint8 *p = writer->buffers[writer->active] + writer->fill[writer->active];
+  memcpy(p, headers, PACKET_OVERHEAD);
+  memcpy(p + PACKET_OVERHEAD, data, size);
+  writer->fill[writer->active] += len;
+  g_mutex_unlock(&writer->lock);
+}
+
+guint64 gst_roc_pcap_writer_get_dropped(GstRocPcapWriter *writer) {
+  g_mutex_lock(&writer->lock);
+  const guint64 dropped = writer->dropped;
+  g_mutex_unlock(&writer->lock);
+  return dropped;
+}
+
+void gst_roc_pcap_writer_free(GstRocPcapWriter *writer) {
+  if (writer->thread) {
+    g_mutex_lock(&writer->lock);
+    writer->running = FALSE;
+    g_cond_signal(&writer->cond);
+    g_mutex_unlock(&writer->lock);
+    g_thread_join(writer->thread);
+  }
+
+  if (writer->file)
+    fclose(writer->file);
+  g_free(writer->buffers[0]);
+  g_free(writer->buffers[1]);
+  g_mutex_clear(&writer->lock);
+  g_cond_clear(&writer->cond);
+  g_free(writer->location);
+  g_free(writer);
+}
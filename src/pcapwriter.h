@@ -0,0 +1,34 @@
+#ifndef PCAPWRITER_H__
+#define PCAPWRITER_H__
+
+#include <gst/gst.h>
+
+/* Which flow a captured packet belongs to, each gets its own UDP ports */
+typedef enum {
+  GST_ROC_PCAP_RTP,      /* sent media packets */
+  GST_ROC_PCAP_RTCP,     /* sent control packets */
+  GST_ROC_PCAP_FEEDBACK, /* received control packets */
+  GST_ROC_PCAP_RTX,      /* sent retransmissions */
+} GstRocPcapFlow;
+
+typedef struct _GstRocPcapWriter GstRocPcapWriter;
+
+/* Open @location and start the flush thread. Once the file grows past
+ * @rotate_size bytes it is moved to "<location>.1" and a new one is
+ * started, 0 never rotates */
+GstRocPcapWriter *gst_roc_pcap_writer_new(const gchar *location,
+                                          guint64 rotate_size, GError **error);
+
+/* Copy a packet captured at @time into the capture buffer. Never blocks on
+ * disk, packets are dropped while both buffers wait to be flushed */
+void gst_roc_pcap_writer_write(GstRocPcapWriter *writer, GstClockTime time,
+                               GstRocPcapFlow flow, const guint8 *data,
+                               gsize size);
+
+/* Packets dropped so far because the flush thread fell behind */
+guint64 gst_roc_pcap_writer_get_dropped(GstRocPcapWriter *writer);
+
+/* Flush what is buffered, stop the flush thread and close the file */
+void gst_roc_pcap_writer_free(GstRocPcapWriter *writer);
+
+#endif /* PCAPWRITER_H__ */
@@ -0,0 +1,34 @@
+#ifndef PROBES_H__
+#define PROBES_H__
+
+/* Static USDT tracepoints for bpftrace/perf/systemtap. They cost a single
+ * nop when nobody is attached and compile out without sys/sdt.h:
+ *
+ *   bpftrace -e 'usdt:libgstrocsend.so:rocsend:packet_pop { @[arg1] = count(); }'
+ */
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define ROCSEND_PROBE2(name, a1, a2) DTRACE_PROBE2(rocsend, name, a1, a2)
+#define ROCSEND_PROBE3(name, a1, a2, a3)                                       \
+  DTRACE_PROBE3(rocsend, name, a1, a2, a3)
+#else
+#define ROCSEND_PROBE2(name, a1, a2)                                           \
+  do {                                                                         \
+  } while (0)
+#define ROCSEND_PROBE3(name, a1, a2, a3)                                       \
+  do {                                                                         \
+  } while (0)
+#endif
+
+/* frame_push(element, bytes) */
+#define ROCSEND_PROBE_FRAME_PUSH(el, bytes) ROCSEND_PROBE2(frame_push, el, bytes)
+/* packet_pop(element, bytes, duration_ns) */
+#define ROCSEND_PROBE_PACKET_POP(el, bytes, duration)                          \
+  ROCSEND_PROBE3(packet_pop, el, bytes, duration)
+/* rtcp_push(element, bytes) */
+#define ROCSEND_PROBE_RTCP_PUSH(el, bytes) ROCSEND_PROBE2(rtcp_push, el, bytes)
+/* feedback_ingest(element, bytes) */
+#define ROCSEND_PROBE_FEEDBACK_INGEST(el, bytes)                               \
+  ROCSEND_PROBE2(feedback_ingest, el, bytes)
+
+#endif /* PROBES_H__ */
@@ -0,0 +1,338 @@
+/* Drives rocsend through a seeded impairment stage (loss, bursts,
+ * reordering, jitter, duplication) into a roc_receiver_decoder in the same
+ * process, in virtual time, and reports end-to-end latency, lost and
+ * recovered samples and CPU cost for each packet-length and encoding. */
+#include <gst/audio/audio.h>
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <math.h>
+#include <roc/config.h>
+#include <roc/context.h>
+#include <roc/packet.h>
+#include <roc/receiver_decoder.h>
+#include <time.h>
+
+#define RATE 44100
+#define CHANNELS 2
+#define STEP_FRAMES 441 /* 10 ms input buffers */
+#define STREAM_SECONDS 10
+#define TARGET_LATENCY (100 * GST_MSECOND)
+/* Clicks are one second apart, far above any expected latency, so each
+ * output click maps to exactly one input click */
+#define CLICK_PERIOD RATE
+#define CLICK_OFFSET (RATE / 2)
+#define CLICK_LEVEL 0.99f
+#define CLICK_DETECT 0.9f
+/* The signal never goes below this, so silence in the output is loss */
+#define SIGNAL_FLOOR 0.1f
+#define LOSS_DETECT 0.01f
+
+typedef struct {
+  const gchar *name;
+  gdouble loss;          /* independent loss probability */
+  gdouble burst_enter;   /* good -> bad probability (Gilbert-Elliott) */
+  gdouble burst_exit;    /* bad -> good probability */
+  gdouble reorder;       /* probability of holding a packet back */
+  GstClockTime jitter;   /* uniform extra delay */
+  gdouble duplicate;     /* probability of sending a packet twice */
+} Impairment;
+
+static const Impairment clean = { "clean", 0, 0, 0, 0, 0, 0 };
+static const Impairment lossy = { "lossy", 0.02, 0.005, 0.3, 0.02,
+  5 * GST_MSECOND, 0.01
+};
+
+typedef struct {
+  GstClockTime deliver_at;
+  GstBuffer *buffer;
+} InFlight;
+
+typedef struct {
+  guint64 packets_sent;
+  guint64 packets_dropped;
+  guint64 packets_reordered;
+  guint64 packets_duplicated;
+  guint64 impaired_samples; /* samples in dropped or held back packets */
+  guint64 lost_samples;     /* output frames concealed after warmup */
+  guint64 played_samples;   /* output frames after warmup */
+  GstClockTime latency_min;
+  GstClockTime latency_max;
+  gdouble cpu_percent;      /* of one core, per real-time stream */
+} LoopbackResult;
+
+static gfloat
+input_sample (guint64 n)
+{
+  if (n % CLICK_PERIOD == CLICK_OFFSET)
+    return CLICK_LEVEL;
+  return SIGNAL_FLOOR + 0.2f * (1.0f + sinf (2 * G_PI * 440 * n / RATE));
+}
+
+static GstBuffer *
+make_input (guint64 first_frame)
+{
+  GstBuffer *buf = gst_buffer_new_allocate (NULL,
+      STEP_FRAMES * CHANNELS * sizeof (gfloat), NULL);
+  GstMapInfo map;
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  gfloat *samples = (gfloat *) map.data;
+  for (guint i = 0; i < STEP_FRAMES; i++)
+    for (guint ch = 0; ch < CHANNELS; ch++)
+      samples[i * CHANNELS + ch] = input_sample (first_frame + i);
+  gst_buffer_unmap (buf, &map);
+
+  GST_BUFFER_PTS (buf) = gst_util_uint64_scale_int (first_frame, GST_SECOND,
+      RATE);
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (STEP_FRAMES,
+      GST_SECOND, RATE);
+  return buf;
+}
+
+static void
+in_flight_add (GArray * queue, GstClockTime deliver_at, GstBuffer * buffer)
+{
+  InFlight item = { deliver_at, buffer };
+  guint i = queue->len;
+  /* Keep the queue ordered by delivery time, stable for equal times */
+  while (i > 0 && g_array_index (queue, InFlight, i - 1).deliver_at >
+      deliver_at)
+    i--;
+  g_array_insert_val (queue, i, item);
+}
+
+static void
+deliver (roc_receiver_decoder * decoder, GArray * queue, GstClockTime now)
+{
+  while (queue->len > 0) {
+    InFlight *item = &g_array_index (queue, InFlight, 0);
+    if (item->deliver_at > now)
+      break;
+
+    GstMapInfo map;
+    gst_buffer_map (item->buffer, &map, GST_MAP_READ);
+    roc_packet packet;
+    memset (&packet, 0, sizeof (packet));
+    packet.bytes = map.data;
+    packet.bytes_size = map.size;
+    fail_unless_equals_int (roc_receiver_decoder_push_packet (decoder,
+            ROC_INTERFACE_AUDIO_SOURCE, &packet), 0);
+    gst_buffer_unmap (item->buffer, &map);
+    gst_buffer_unref (item->buffer);
+    g_array_remove_index (queue, 0);
+  }
+}
+
+static void
+run_loopback (const Impairment * imp, GstClockTime packet_length,
+    guint encoding, guint32 seed, LoopbackResult * res)
+{
+  memset (res, 0, sizeof (*res));
+  res->latency_min = GST_CLOCK_TIME_NONE;
+
+  GRand *rand = g_rand_new_with_seed (seed);
+  GArray *queue = g_array_new (FALSE, FALSE, sizeof (InFlight));
+  gboolean burst = FALSE;
+
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "packet-length", (guint64) packet_length,
+      "packet-encoding", encoding, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  roc_context *context = NULL;
+  roc_context_config context_config;
+  memset (&context_config, 0, sizeof (context_config));
+  fail_unless_equals_int (roc_context_open (&context_config, &context), 0);
+
+  roc_receiver_config receiver_config;
+  memset (&receiver_config, 0, sizeof (receiver_config));
+  receiver_config.frame_encoding.rate = RATE;
+  receiver_config.frame_encoding.format = ROC_FORMAT_PCM;
+  receiver_config.frame_encoding.subformat = ROC_SUBFORMAT_PCM_FLOAT32_LE;
+  receiver_config.frame_encoding.channels = ROC_CHANNEL_LAYOUT_STEREO;
+  receiver_config.clock_source = ROC_CLOCK_SOURCE_EXTERNAL;
+  receiver_config.latency_tuner_profile = ROC_LATENCY_TUNER_PROFILE_INTACT;
+  receiver_config.target_latency = TARGET_LATENCY;
+
+  roc_receiver_decoder *decoder = NULL;
+  fail_unless_equals_int (roc_receiver_decoder_open (context,
+          &receiver_config, &decoder), 0);
+  fail_unless_equals_int (roc_receiver_decoder_activate (decoder,
+          ROC_INTERFACE_AUDIO_SOURCE, ROC_PROTO_RTP), 0);
+
+  gfloat out[STEP_FRAMES * CHANNELS];
+  guint64 last_click_in = G_MAXUINT64;
+  gboolean warmed_up = FALSE;
+
+  struct timespec cpu_start, cpu_end;
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu_start);
+
+  const guint steps = STREAM_SECONDS * RATE / STEP_FRAMES;
+  for (guint step = 0; step < steps; step++) {
+    const guint64 first_frame = (guint64) step * STEP_FRAMES;
+    const GstClockTime now = gst_util_uint64_scale_int (first_frame,
+        GST_SECOND, RATE);
+
+    fail_unless_equals_int (gst_harness_push (h, make_input (first_frame)),
+        GST_FLOW_OK);
+
+    GstBuffer *pkt;
+    while ((pkt = gst_harness_try_pull (h))) {
+      const guint64 pkt_samples = gst_util_uint64_scale_int (
+          GST_BUFFER_DURATION (pkt), RATE, GST_SECOND);
+      res->packets_sent++;
+
+      if (burst)
+        burst = g_rand_double (rand) >= imp->burst_exit;
+      else
+        burst = g_rand_double (rand) < imp->burst_enter;
+      if (burst || g_rand_double (rand) < imp->loss) {
+        res->packets_dropped++;
+        res->impaired_samples += pkt_samples;
+        gst_buffer_unref (pkt);
+        continue;
+      }
+
+      GstClockTime delay = imp->jitter ?
+          g_rand_int_range (rand, 0, imp->jitter / GST_USECOND) * GST_USECOND
+          : 0;
+      if (g_rand_double (rand) < imp->reorder) {
+        delay += 2 * packet_length;
+        res->packets_reordered++;
+        res->impaired_samples += pkt_samples;
+      }
+      if (g_rand_double (rand) < imp->duplicate) {
+        res->packets_duplicated++;
+        in_flight_add (queue, now + delay, gst_buffer_ref (pkt));
+      }
+      in_flight_add (queue, now + delay, pkt);
+    }
+
+    deliver (decoder, queue, now);
+
+    roc_frame frame;
+    memset (&frame, 0, sizeof (frame));
+    frame.samples = out;
+    frame.samples_size = sizeof (out);
+    fail_unless_equals_int (roc_receiver_decoder_pop_frame (decoder, &frame),
+        0);
+
+    for (guint i = 0; i < STEP_FRAMES; i++) {
+      const guint64 n = first_frame + i;
+      if (input_sample (n) == CLICK_LEVEL)
+        last_click_in = n;
+
+      const gfloat v = out[i * CHANNELS];
+      if (v > CLICK_DETECT && last_click_in != G_MAXUINT64) {
+        const GstClockTime latency = gst_util_uint64_scale_int (
+            n - last_click_in, GST_SECOND, RATE);
+        res->latency_min = MIN (res->latency_min, latency);
+        res->latency_max = MAX (res->latency_max, latency);
+        warmed_up = TRUE;
+      }
+      if (warmed_up) {
+        res->played_samples++;
+        if (fabsf (v) < LOSS_DETECT)
+          res->lost_samples++;
+      }
+    }
+  }
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu_end);
+  const gdouble cpu_seconds = (cpu_end.tv_sec - cpu_start.tv_sec) +
+      (cpu_end.tv_nsec - cpu_start.tv_nsec) / 1e9;
+  res->cpu_percent = 100.0 * cpu_seconds / STREAM_SECONDS;
+
+  for (guint i = 0; i < queue->len; i++)
+    gst_buffer_unref (g_array_index (queue, InFlight, i).buffer);
+  g_array_unref (queue);
+  roc_receiver_decoder_close (decoder);
+  roc_context_close (context);
+  gst_harness_teardown (h);
+  g_rand_free (rand);
+}
+
+static void
+report (const Impairment * imp, GstClockTime packet_length, guint encoding,
+    const LoopbackResult * res)
+{
+  const guint64 recovered = res->impaired_samples > res->lost_samples ?
+      res->impaired_samples - res->lost_samples : 0;
+  g_print ("%-6s len=%-3" G_GUINT64_FORMAT "ms enc=%-2u sent=%-5"
+      G_GUINT64_FORMAT " drop=%-4" G_GUINT64_FORMAT " reord=%-4"
+      G_GUINT64_FORMAT " dup=%-4" G_GUINT64_FORMAT " latency=%"
+      GST_TIME_FORMAT "..%" GST_TIME_FORMAT " lost=%" G_GUINT64_FORMAT
+      "/%" G_GUINT64_FORMAT " recovered=%" G_GUINT64_FORMAT " cpu=%.2f%%\n",
+      imp->name, packet_length / GST_MSECOND, encoding, res->packets_sent,
+      res->packets_dropped, res->packets_reordered, res->packets_duplicated,
+      GST_TIME_ARGS (res->latency_min), GST_TIME_ARGS (res->latency_max),
+      res->lost_samples, res->played_samples, recovered, res->cpu_percent);
+}
+
+static const GstClockTime packet_lengths[] = {
+  5 * GST_MSECOND, 10 * GST_MSECOND, 20 * GST_MSECOND
+};
+
+static const guint encodings[] = {
+  ROC_PACKET_ENCODING_AVP_L16_STEREO, ROC_PACKET_ENCODING_AVP_L16_MONO
+};
+
+static guint32
+test_seed (void)
+{
+  const gchar *env = g_getenv ("ROCSEND_LOOPBACK_SEED");
+  return env ? (guint32) g_ascii_strtoull (env, NULL, 10) : 42;
+}
+
+GST_START_TEST (test_loopback_clean)
+{
+  const guint i = __i__ % G_N_ELEMENTS (packet_lengths);
+  const guint e = __i__ / G_N_ELEMENTS (packet_lengths);
+  LoopbackResult res;
+
+  run_loopback (&clean, packet_lengths[i], encodings[e], test_seed (), &res);
+  report (&clean, packet_lengths[i], encodings[e], &res);
+
+  /* Stream decodes, with no concealment and a stable latency near the
+   * receiver target */
+  fail_unless (res.played_samples > 0);
+  fail_unless_equals_uint64 (res.lost_samples, 0);
+  fail_unless (res.latency_max - res.latency_min <= packet_lengths[i]);
+  fail_unless (res.latency_min >= TARGET_LATENCY / 2);
+  fail_unless (res.latency_max <= 2 * TARGET_LATENCY + packet_lengths[i]);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_loopback_lossy)
+{
+  const guint i = __i__ % G_N_ELEMENTS (packet_lengths);
+  const guint e = __i__ / G_N_ELEMENTS (packet_lengths);
+  LoopbackResult res;
+
+  run_loopback (&lossy, packet_lengths[i], encodings[e], test_seed (), &res);
+  report (&lossy, packet_lengths[i], encodings[e], &res);
+
+  /* Held back packets still arrive within the target latency; only
+   * dropped packets may turn into concealment */
+  fail_unless (res.packets_dropped > 0);
+  fail_unless (res.played_samples > 0);
+  fail_unless (res.lost_samples < res.played_samples / 5);
+}
+GST_END_TEST;
+
+static Suite *
+loopback_suite (void)
+{
+  Suite *s = suite_create ("loopback");
+  TCase *tc_chain = tcase_create ("general");
+  const gint n = G_N_ELEMENTS (packet_lengths) * G_N_ELEMENTS (encodings);
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_loop_test (tc_chain, test_loopback_clean, 0, n);
+  tcase_add_loop_test (tc_chain, test_loopback_lossy, 0, n);
+
+  return s;
+}
+
+GST_CHECK_MAIN (loopback);
@@ -1,7 +1,11 @@
 #include "gst/check/internal-check.h"
 #include <gst/check/gstcheck.h>
 #include <gst/check/gstharness.h>
+#include <gst/audio/audio.h>
+#include <gst/rtp/gstrtcpbuffer.h>
 #include <gst/rtp/gstrtpbuffer.h>
+#include <glib/gstdio.h>
+#include <math.h>
 
 GST_START_TEST (test_simple_sin)
 {
@@ -55,6 +59,720 @@ GST_START_TEST (test_simple_sin)
 }
 GST_END_TEST;
 
+GST_START_TEST (test_allocation_query)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "packet-length", (guint64) (5 * GST_MSECOND),
+      NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=48000,"
+      "channels=2,layout=interleaved");
+
+  GstCaps *caps = gst_caps_from_string ("audio/x-raw,format=F32LE,"
+      "rate=48000,channels=2,layout=interleaved");
+  GstQuery *query = gst_query_new_allocation (caps, TRUE);
+  gst_caps_unref (caps);
+  fail_unless (gst_pad_peer_query (h->srcpad, query));
+
+  /* Buffers hold whole packets: 5 ms at 48 kHz is 240 stereo float frames */
+  const guint packet_size = 240 * 2 * sizeof (gfloat);
+  guint size = 0;
+  fail_unless (gst_query_get_n_allocation_pools (query) > 0);
+  gst_query_parse_nth_allocation_pool (query, 0, NULL, &size, NULL, NULL);
+  fail_unless (size > 0);
+  fail_unless_equals_int (size % packet_size, 0);
+
+  GstAllocationParams params;
+  fail_unless (gst_query_get_n_allocation_params (query) > 0);
+  gst_query_parse_nth_allocation_param (query, 0, NULL, &params);
+  fail_unless_equals_int (params.align, 63);
+
+  fail_unless (gst_query_find_allocation_meta (query, GST_AUDIO_META_API_TYPE,
+          NULL));
+
+  gst_query_unref (query);
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+#define PLANAR_RATE 44100
+#define PLANAR_FRAMES 441
+
+static const GstAudioChannelPosition surround_pos[] = {
+  GST_AUDIO_CHANNEL_POSITION_FRONT_LEFT,
+  GST_AUDIO_CHANNEL_POSITION_FRONT_RIGHT,
+  GST_AUDIO_CHANNEL_POSITION_FRONT_CENTER,
+  GST_AUDIO_CHANNEL_POSITION_LFE1,
+  GST_AUDIO_CHANNEL_POSITION_REAR_LEFT,
+  GST_AUDIO_CHANNEL_POSITION_REAR_RIGHT
+};
+
+static GstBuffer *
+make_test_buffer (GstAudioLayout layout, guint channels, guint index)
+{
+  GstAudioInfo info;
+  gst_audio_info_set_format (&info, GST_AUDIO_FORMAT_F32LE, PLANAR_RATE,
+      channels, surround_pos);
+  GST_AUDIO_INFO_LAYOUT (&info) = layout;
+
+  GstBuffer *buf = gst_buffer_new_allocate (NULL,
+      PLANAR_FRAMES * GST_AUDIO_INFO_BPF (&info), NULL);
+  GstMapInfo map;
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  gfloat *samples = (gfloat *) map.data;
+  for (guint i = 0; i < PLANAR_FRAMES; i++) {
+    for (guint ch = 0; ch < channels; ch++) {
+      const gfloat v = (ch ? 0.25f : -0.5f) *
+          (((index * PLANAR_FRAMES + i) % 100) / 100.0f);
+      if (layout == GST_AUDIO_LAYOUT_INTERLEAVED)
+        samples[i * channels + ch] = v;
+      else
+        samples[ch * PLANAR_FRAMES + i] = v;
+    }
+  }
+  gst_buffer_unmap (buf, &map);
+
+  if (layout == GST_AUDIO_LAYOUT_NON_INTERLEAVED)
+    gst_buffer_add_audio_meta (buf, &info, PLANAR_FRAMES, NULL);
+  GST_BUFFER_PTS (buf) = gst_util_uint64_scale_int (index * PLANAR_FRAMES,
+      GST_SECOND, PLANAR_RATE);
+  GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (PLANAR_FRAMES,
+      GST_SECOND, PLANAR_RATE);
+  return buf;
+}
+
+/* Collects RTP payloads produced for a layout into one byte array */
+static GByteArray *
+encode_with_layout (const gchar * layout, guint channels)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  guint64 mask = 0;
+  gst_audio_channel_positions_to_mask (surround_pos, channels, FALSE, &mask);
+  gchar *caps = g_strdup_printf ("audio/x-raw,format=F32LE,rate=%d,"
+      "channels=%u,channel-mask=(bitmask)0x%" G_GINT64_MODIFIER "x,"
+      "layout=%s", PLANAR_RATE, channels, mask, layout);
+  gst_harness_set_src_caps_str (h, caps);
+  g_free (caps);
+
+  const GstAudioLayout l = g_str_equal (layout, "interleaved") ?
+      GST_AUDIO_LAYOUT_INTERLEAVED : GST_AUDIO_LAYOUT_NON_INTERLEAVED;
+  GByteArray *payloads = g_byte_array_new ();
+  for (guint i = 0; i < 20; i++) {
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer (l,
+                channels, i)), GST_FLOW_OK);
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h))) {
+      GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+      fail_unless (gst_rtp_buffer_map (buff, GST_MAP_READ, &rtp));
+      g_byte_array_append (payloads, gst_rtp_buffer_get_payload (&rtp),
+          gst_rtp_buffer_get_payload_len (&rtp));
+      gst_rtp_buffer_unmap (&rtp);
+      gst_buffer_unref (buff);
+    }
+  }
+  gst_harness_teardown (h);
+  return payloads;
+}
+
+GST_START_TEST (test_planar_input)
+{
+  GByteArray *interleaved = encode_with_layout ("interleaved", 2);
+  GByteArray *planar = encode_with_layout ("non-interleaved", 2);
+
+  fail_unless (interleaved->len > 0);
+  fail_unless_equals_int (interleaved->len, planar->len);
+  fail_unless (memcmp (interleaved->data, planar->data, planar->len) == 0);
+
+  g_byte_array_unref (interleaved);
+  g_byte_array_unref (planar);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_surround_downmix)
+{
+  GByteArray *stereo = encode_with_layout ("interleaved", 2);
+  GByteArray *surround = encode_with_layout ("interleaved", 6);
+  GByteArray *planar = encode_with_layout ("non-interleaved", 6);
+
+  /* 5.1 input is downmixed to the stereo packet encoding */
+  fail_unless (surround->len > 0);
+  fail_unless_equals_int (stereo->len, surround->len);
+  fail_unless_equals_int (surround->len, planar->len);
+  fail_unless (memcmp (surround->data, planar->data, planar->len) == 0);
+
+  g_byte_array_unref (stereo);
+  g_byte_array_unref (surround);
+  g_byte_array_unref (planar);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_surround_without_downmix)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "downmix", FALSE, NULL);
+  guint64 mask = 0;
+  gst_audio_channel_positions_to_mask (surround_pos, 6, FALSE, &mask);
+  gchar *caps = g_strdup_printf ("audio/x-raw,format=F32LE,rate=%d,"
+      "channels=6,channel-mask=(bitmask)0x%" G_GINT64_MODIFIER "x,"
+      "layout=interleaved", PLANAR_RATE, mask);
+  gst_harness_set_src_caps_str (h, caps);
+  g_free (caps);
+
+  /* Six channels don't fit the stereo packet encoding */
+  fail_unless_equals_int (gst_harness_push (h,
+          make_test_buffer (GST_AUDIO_LAYOUT_INTERLEAVED, 6, 0)),
+      GST_FLOW_NOT_NEGOTIATED);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+static GstBuffer *
+make_silent_buffer (guint index)
+{
+  GstBuffer *buf = make_test_buffer (GST_AUDIO_LAYOUT_INTERLEAVED, 2, index);
+  gst_buffer_memset (buf, 0, 0, gst_buffer_get_size (buf));
+  return buf;
+}
+
+GST_START_TEST (test_dtx_silence)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "dtx", TRUE, "dtx-hangover", 50 * GST_MSECOND,
+      "dtx-keepalive", 200 * GST_MSECOND, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  /* 1 s of silence followed by 100 ms of signal */
+  guint silent_packets = 0, seq = 0, marked = 0;
+  gboolean got_seq = FALSE;
+  for (guint i = 0; i < 110; i++) {
+    GstBuffer *in = i < 100 ? make_silent_buffer (i) :
+        make_test_buffer (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i);
+    fail_unless_equals_int (gst_harness_push (h, in), GST_FLOW_OK);
+
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h))) {
+      GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+      fail_unless (gst_rtp_buffer_map (buff, GST_MAP_READ, &rtp));
+      const guint16 cur_seq = gst_rtp_buffer_get_seq (&rtp);
+      if (got_seq)
+        fail_unless_equals_int ((guint16) (seq + 1), cur_seq);
+      seq = cur_seq;
+      got_seq = TRUE;
+      if (i < 100)
+        silent_packets++;
+      if (gst_rtp_buffer_get_marker (&rtp))
+        marked++;
+      gst_rtp_buffer_unmap (&rtp);
+      gst_buffer_unref (buff);
+    }
+  }
+
+  GstStructure *stats;
+  guint64 sent = 0, suppressed = 0;
+  g_object_get (h->element, "stats", &stats, NULL);
+  gst_structure_get_uint64 (stats, "packets-sent", &sent);
+  gst_structure_get_uint64 (stats, "packets-suppressed", &suppressed);
+  gst_structure_free (stats);
+
+  /* Hangover plus a handful of keepalives instead of 1 s of packets */
+  fail_unless (suppressed > 0);
+  fail_unless (silent_packets < suppressed);
+  fail_unless_equals_int (marked, 1);
+  fail_unless (sent > 0);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+static GstBuffer *
+make_nack (guint32 media_ssrc, guint16 pid, guint16 blp)
+{
+  GstBuffer *buf = gst_rtcp_buffer_new (1400);
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  GstRTCPPacket packet;
+
+  gst_rtcp_buffer_map (buf, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RTPFB,
+          &packet));
+  gst_rtcp_packet_fb_set_type (&packet, GST_RTCP_RTPFB_TYPE_NACK);
+  gst_rtcp_packet_fb_set_sender_ssrc (&packet, 0x12345678);
+  gst_rtcp_packet_fb_set_media_ssrc (&packet, media_ssrc);
+  fail_unless (gst_rtcp_packet_fb_set_fci_length (&packet, 1));
+  guint8 *fci = gst_rtcp_packet_fb_get_fci (&packet);
+  GST_WRITE_UINT16_BE (fci, pid);
+  GST_WRITE_UINT16_BE (fci + 2, blp);
+  gst_rtcp_buffer_unmap (&rtcp);
+  return buf;
+}
+
+GST_START_TEST (test_nack_retransmission)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "rtx-history-size", 64, "rtx-payload-type", 99,
+      NULL);
+  GstHarness *h_rtcp = gst_harness_new_with_element (h->element,
+      "rtcp_sink_%u", NULL);
+  GstHarness *h_rtx = gst_harness_new_with_element (h->element, NULL,
+      "rtx_src_%u");
+  gst_harness_set_src_caps_str (h_rtcp, "application/x-rtcp");
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  for (guint i = 0; i < 10; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+
+  /* Pick two sent packets, NACK the first and the one after it */
+  fail_unless (gst_harness_buffers_in_queue (h) > 4);
+  GstBuffer *sent[2];
+  sent[0] = gst_harness_pull (h);
+  sent[1] = gst_harness_pull (h);
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  fail_unless (gst_rtp_buffer_map (sent[0], GST_MAP_READ, &rtp));
+  const guint32 ssrc = gst_rtp_buffer_get_ssrc (&rtp);
+  const guint16 seq = gst_rtp_buffer_get_seq (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+
+  fail_unless_equals_int (gst_harness_push (h_rtcp, make_nack (ssrc, seq,
+              0x0001)), GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h_rtx), 2);
+
+  for (guint i = 0; i < 2; i++) {
+    GstBuffer *rtx = gst_harness_pull (h_rtx);
+    GstRTPBuffer orig_rtp = GST_RTP_BUFFER_INIT;
+    fail_unless (gst_rtp_buffer_map (rtx, GST_MAP_READ, &rtp));
+    fail_unless (gst_rtp_buffer_map (sent[i], GST_MAP_READ, &orig_rtp));
+    fail_unless_equals_int (gst_rtp_buffer_get_payload_type (&rtp), 99);
+    fail_if (gst_rtp_buffer_get_ssrc (&rtp) == ssrc);
+    fail_unless_equals_int (gst_rtp_buffer_get_timestamp (&rtp),
+        gst_rtp_buffer_get_timestamp (&orig_rtp));
+    const guint8 *payload = gst_rtp_buffer_get_payload (&rtp);
+    fail_unless_equals_int (GST_READ_UINT16_BE (payload), (guint16) (seq + i));
+    fail_unless_equals_int (gst_rtp_buffer_get_payload_len (&rtp),
+        gst_rtp_buffer_get_payload_len (&orig_rtp) + 2);
+    fail_unless (memcmp (payload + 2, gst_rtp_buffer_get_payload (&orig_rtp),
+            gst_rtp_buffer_get_payload_len (&orig_rtp)) == 0);
+    gst_rtp_buffer_unmap (&orig_rtp);
+    gst_rtp_buffer_unmap (&rtp);
+    gst_buffer_unref (rtx);
+    gst_buffer_unref (sent[i]);
+  }
+
+  gst_harness_teardown (h_rtx);
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_live_packet_length)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "packet-length", (guint64) (5 * GST_MSECOND),
+      NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  guint16 seq = 0;
+  guint32 ssrc = 0, ts = 0;
+  gboolean got_seq = FALSE, switched = FALSE;
+  for (guint i = 0; i < 200 && !switched; i++) {
+    if (i == 10)
+      g_object_set (h->element, "packet-length",
+          (guint64) (20 * GST_MSECOND), NULL);
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h))) {
+      GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+      fail_unless (gst_rtp_buffer_map (buff, GST_MAP_READ, &rtp));
+      /* One stream across the encoder rebuild */
+      if (got_seq) {
+        fail_unless_equals_int ((guint16) (seq + 1),
+            gst_rtp_buffer_get_seq (&rtp));
+        fail_unless_equals_int (ssrc, gst_rtp_buffer_get_ssrc (&rtp));
+        fail_unless ((gint32) (gst_rtp_buffer_get_timestamp (&rtp) - ts) > 0);
+      }
+      seq = gst_rtp_buffer_get_seq (&rtp);
+      ssrc = gst_rtp_buffer_get_ssrc (&rtp);
+      ts = gst_rtp_buffer_get_timestamp (&rtp);
+      got_seq = TRUE;
+      if (GST_BUFFER_DURATION (buff) == 20 * GST_MSECOND)
+        switched = TRUE;
+      gst_rtp_buffer_unmap (&rtp);
+      gst_buffer_unref (buff);
+    }
+    /* The new encoder is opened in the background */
+    g_usleep (1000);
+  }
+  fail_unless (switched);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_qos_late_drop)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "max-lateness", (gint64) 0, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  for (guint i = 0; i < 10; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+  const guint sent = gst_harness_buffers_in_queue (h);
+  fail_unless (sent > 0);
+
+  /* Downstream is a second behind: everything up to then is dropped */
+  fail_unless (gst_harness_push_upstream_event (h,
+          gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW, 1.0,
+              500 * GST_MSECOND, 100 * GST_MSECOND)));
+  for (guint i = 10; i < 50; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), sent);
+
+  GstStructure *stats;
+  guint64 late = 0;
+  g_object_get (h->element, "stats", &stats, NULL);
+  gst_structure_get_uint64 (stats, "buffers-late", &late);
+  gst_structure_free (stats);
+  fail_unless_equals_uint64 (late, 40);
+
+  /* Input past the QoS earliest time goes out again */
+  for (guint i = 150; i < 160; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+  fail_unless (gst_harness_buffers_in_queue (h) > sent);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_live_latency)
+{
+  /* A live source pushes each buffer a buffer duration after its timestamp,
+   * within the latency it reports: nothing is late */
+  GstElement *pipeline = gst_parse_launch ("audiotestsrc is-live=true "
+      "num-buffers=50 samplesperbuffer=441 ! audio/x-raw,format=F32LE,"
+      "rate=44100,channels=2 ! rocsend name=send max-lateness=1000000 ! "
+      "fakesink sync=true", NULL);
+  fail_unless (pipeline != NULL);
+
+  fail_unless (gst_element_set_state (pipeline, GST_STATE_PLAYING) !=
+      GST_STATE_CHANGE_FAILURE);
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (msg != NULL);
+  fail_unless_equals_int (GST_MESSAGE_TYPE (msg), GST_MESSAGE_EOS);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  GstElement *send = gst_bin_get_by_name (GST_BIN (pipeline), "send");
+  GstStructure *stats;
+  guint64 late = 0;
+  g_object_get (send, "stats", &stats, NULL);
+  gst_structure_get_uint64 (stats, "buffers-late", &late);
+  gst_structure_free (stats);
+  fail_unless_equals_uint64 (late, 0);
+  gst_object_unref (send);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_drift_estimate)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "drift-compensation", TRUE, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  /* Input runs 200 ppm fast against the pipeline clock */
+  for (guint i = 0; i < 300; i++) {
+    gst_harness_set_time (h, gst_util_uint64_scale (i * 10 * GST_MSECOND,
+            1000000, 1000200));
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+  }
+
+  gdouble ppm = 0;
+  g_object_get (h->element, "drift-ppm", &ppm, NULL);
+  fail_unless (fabs (ppm - 200) < 5, "measured %f ppm", ppm);
+
+  /* Resampled audio keeps flowing */
+  fail_unless (gst_harness_buffers_in_queue (h) > 0);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_drift_jitter)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "drift-compensation", TRUE, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  /* 200 ppm fast again, each buffer arriving up to 1 ms late */
+  GRand *rand = g_rand_new_with_seed (42);
+  for (guint i = 0; i < 1000; i++) {
+    gst_harness_set_time (h, gst_util_uint64_scale (i * 10 * GST_MSECOND,
+            1000000, 1000200) + g_rand_int_range (rand, 0, GST_MSECOND));
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h)))
+      gst_buffer_unref (buff);
+  }
+  g_rand_free (rand);
+
+  gdouble ppm = 0;
+  g_object_get (h->element, "drift-ppm", &ppm, NULL);
+  fail_unless (fabs (ppm - 200) < 20, "measured %f ppm", ppm);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_pacing)
+{
+  /* Pacing is set up when the src pad activates */
+  GstHarness *h = gst_harness_new_parse ("rocsend pacing=true max-burst=3 "
+      "packet-length=5000000");
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  /* 100 ms of audio at once */
+  for (guint i = 0; i < 10; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+
+  /* A burst of max-burst packets, then one per packet duration */
+  fail_unless (gst_harness_wait_for_clock_id_waits (h, 1, 5));
+  fail_unless_equals_int (gst_harness_buffers_received (h), 3);
+  for (guint i = 0; i < 5; i++) {
+    const GstClockTime before = gst_clock_get_time (GST_CLOCK (h->testclock));
+    fail_unless (gst_harness_crank_single_clock_wait (h));
+    const GstClockTime step =
+        gst_clock_get_time (GST_CLOCK (h->testclock)) - before;
+    fail_unless (step > 4 * GST_MSECOND && step <= 5 * GST_MSECOND);
+    fail_unless (gst_harness_wait_for_clock_id_waits (h, 1, 5));
+    fail_unless_equals_int (gst_harness_buffers_received (h), 4 + i);
+  }
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+/* Pushes input @first to @last and checks that the RTP timestamps of what
+ * comes out count the capture clock time in samples */
+static guint
+push_clock_timed (GstHarness * h, guint first, guint last)
+{
+  const GstClockTime base_time = gst_element_get_base_time (h->element);
+  guint received = 0;
+
+  for (guint i = first; i < last; i++) {
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h))) {
+      const guint32 expected = (guint32) gst_util_uint64_scale_int (base_time
+          + GST_BUFFER_PTS (buff), PLANAR_RATE, GST_SECOND);
+      GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+      fail_unless (gst_rtp_buffer_map (buff, GST_MAP_READ, &rtp));
+      const gint32 diff = (gint32) (gst_rtp_buffer_get_timestamp (&rtp) -
+          expected);
+      fail_unless (ABS (diff) <= 2, "timestamp off by %d", diff);
+      gst_rtp_buffer_unmap (&rtp);
+      gst_buffer_unref (buff);
+      received++;
+    }
+  }
+  return received;
+}
+
+GST_START_TEST (test_pipeline_clock_timebase)
+{
+  GstHarness *h = gst_harness_new ("rocsend");
+  g_object_set (h->element, "use-pipeline-clock", TRUE, NULL);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  fail_unless (push_clock_timed (h, 100, 120) > 0);
+
+  /* Late input is dropped, the timestamps keep following the clock */
+  g_object_set (h->element, "max-lateness", (gint64) 0, NULL);
+  fail_unless (gst_harness_push_upstream_event (h,
+          gst_event_new_qos (GST_QOS_TYPE_UNDERFLOW, 1.0,
+              500 * GST_MSECOND, GST_SECOND)));
+  fail_unless_equals_int (push_clock_timed (h, 120, 140), 0);
+  fail_unless (push_clock_timed (h, 150, 170) > 0);
+
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_pcap_dump)
+{
+  gchar *dir = g_dir_make_tmp ("rocsend-XXXXXX", NULL);
+  fail_unless (dir != NULL);
+  gchar *location = g_build_filename (dir, "dump.pcap", NULL);
+
+  gchar *desc = g_strdup_printf ("rocsend dump-location=\"%s\"", location);
+  GstHarness *h = gst_harness_new_parse (desc);
+  g_free (desc);
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  guint sent = 0;
+  for (guint i = 0; i < 20; i++) {
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+    GstBuffer *buff;
+    while ((buff = gst_harness_try_pull (h))) {
+      gst_buffer_unref (buff);
+      sent++;
+    }
+  }
+  fail_unless (sent > 0);
+  /* Stopping flushes the capture */
+  gst_harness_teardown (h);
+
+  gchar *contents;
+  gsize length;
+  fail_unless (g_file_get_contents (location, &contents, &length, NULL));
+  fail_unless (length > 24);
+  guint32 magic;
+  memcpy (&magic, contents, 4);
+  fail_unless_equals_int (magic, 0xa1b23c4d);
+
+  /* Every sent RTP packet is in there, in a raw IPv4/UDP record */
+  guint records = 0;
+  for (gsize offset = 24; offset + 16 <= length;) {
+    guint32 incl_len;
+    memcpy (&incl_len, contents + offset + 8, 4);
+    fail_unless (offset + 16 + incl_len <= length);
+    const guint8 *ip = (const guint8 *) contents + offset + 16;
+    fail_unless_equals_int (ip[0], 0x45);
+    fail_unless_equals_int (ip[9], 17);
+    if (GST_READ_UINT16_BE (ip + 22) == 5004) {
+      fail_unless_equals_int (ip[28] >> 6, 2);
+      records++;
+    }
+    offset += 16 + incl_len;
+  }
+  fail_unless_equals_int (records, sent);
+
+  g_free (contents);
+  g_unlink (location);
+  g_rmdir (dir);
+  g_free (location);
+  g_free (dir);
+}
+GST_END_TEST;
+
+/* Receiver report with one block about @media_ssrc, and its CNAME */
+static GstBuffer *
+make_rr (guint32 media_ssrc)
+{
+  GstBuffer *buf = gst_rtcp_buffer_new (1400);
+  GstRTCPBuffer rtcp = GST_RTCP_BUFFER_INIT;
+  GstRTCPPacket packet;
+
+  gst_rtcp_buffer_map (buf, GST_MAP_READWRITE, &rtcp);
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_RR, &packet));
+  gst_rtcp_packet_rr_set_ssrc (&packet, 0x12345678);
+  fail_unless (gst_rtcp_packet_add_rb (&packet, media_ssrc, 0, 0, 0, 0, 0,
+          0));
+  fail_unless (gst_rtcp_buffer_add_packet (&rtcp, GST_RTCP_TYPE_SDES,
+          &packet));
+  fail_unless (gst_rtcp_packet_sdes_add_item (&packet, 0x12345678));
+  fail_unless (gst_rtcp_packet_sdes_add_entry (&packet, GST_RTCP_SDES_CNAME,
+          4, (const guint8 *) "test"));
+  gst_rtcp_buffer_unmap (&rtcp);
+  return buf;
+}
+
+static guint64
+get_feedback_applied (GstElement * element)
+{
+  GstStructure *stats;
+  guint64 applied = 0;
+
+  g_object_get (element, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "feedback-applied",
+          &applied));
+  gst_structure_free (stats);
+  return applied;
+}
+
+GST_START_TEST (test_feedback_handoff)
+{
+  GstElement *element = gst_element_factory_make ("rocsend", NULL);
+  g_object_set (element, "feedback-handoff", TRUE, NULL);
+  GstHarness *h = gst_harness_new_with_element (element, "sink", "src");
+  GstHarness *h_rtcp = gst_harness_new_with_element (element,
+      "rtcp_sink_%u", NULL);
+  gst_object_unref (element);
+  gst_harness_set_src_caps_str (h_rtcp, "application/x-rtcp");
+  gst_harness_set_src_caps_str (h, "audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2,layout=interleaved");
+
+  for (guint i = 0; i < 10; i++)
+    fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+            (GST_AUDIO_LAYOUT_INTERLEAVED, 2, i)), GST_FLOW_OK);
+  GstBuffer *sent = gst_harness_pull (h);
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  fail_unless (gst_rtp_buffer_map (sent, GST_MAP_READ, &rtp));
+  const guint32 ssrc = gst_rtp_buffer_get_ssrc (&rtp);
+  gst_rtp_buffer_unmap (&rtp);
+  gst_buffer_unref (sent);
+
+  /* Feedback waits for the next audio buffer, past 64 packets it's dropped */
+  for (guint i = 0; i < 70; i++)
+    fail_unless_equals_int (gst_harness_push (h_rtcp, make_nack (ssrc, i, 0)),
+        GST_FLOW_OK);
+  GstStructure *stats;
+  guint64 dropped = 0;
+  g_object_get (h->element, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "feedback-dropped", &dropped));
+  fail_unless_equals_uint64 (dropped, 6);
+  gst_structure_free (stats);
+
+  /* Applying it frees the queue up again */
+  fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+          (GST_AUDIO_LAYOUT_INTERLEAVED, 2, 10)), GST_FLOW_OK);
+  for (guint i = 0; i < 64; i++)
+    fail_unless_equals_int (gst_harness_push (h_rtcp, make_nack (ssrc, i, 0)),
+        GST_FLOW_OK);
+  g_object_get (h->element, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "feedback-dropped", &dropped));
+  fail_unless_equals_uint64 (dropped, 6);
+  gst_structure_free (stats);
+
+  /* A receiver report reaches the encoder with the next audio buffer */
+  fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+          (GST_AUDIO_LAYOUT_INTERLEAVED, 2, 11)), GST_FLOW_OK);
+  const guint64 applied = get_feedback_applied (h->element);
+  fail_unless_equals_int (gst_harness_push (h_rtcp, make_rr (ssrc)),
+      GST_FLOW_OK);
+  fail_unless_equals_uint64 (get_feedback_applied (h->element), applied);
+  fail_unless_equals_int (gst_harness_push (h, make_test_buffer
+          (GST_AUDIO_LAYOUT_INTERLEAVED, 2, 12)), GST_FLOW_OK);
+  fail_unless_equals_uint64 (get_feedback_applied (h->element), applied + 1);
+
+  gst_harness_teardown (h_rtcp);
+  gst_harness_teardown (h);
+}
+GST_END_TEST;
+
 static Suite *
 sender_suite (void)
 {
@@ -63,6 +781,21 @@ sender_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_simple_sin);
+  tcase_add_test (tc_chain, test_allocation_query);
+  tcase_add_test (tc_chain, test_planar_input);
+  tcase_add_test (tc_chain, test_surround_downmix);
+  tcase_add_test (tc_chain, test_surround_without_downmix);
+  tcase_add_test (tc_chain, test_dtx_silence);
+  tcase_add_test (tc_chain, test_nack_retransmission);
+  tcase_add_test (tc_chain, test_live_packet_length);
+  tcase_add_test (tc_chain, test_qos_late_drop);
+  tcase_add_test (tc_chain, test_live_latency);
+  tcase_add_test (tc_chain, test_drift_estimate);
+  tcase_add_test (tc_chain, test_drift_jitter);
+  tcase_add_test (tc_chain, test_pacing);
+  tcase_add_test (tc_chain, test_pipeline_clock_timebase);
+  tcase_add_test (tc_chain, test_pcap_dump);
+  tcase_add_test (tc_chain, test_feedback_handoff);
 
   return s;
 }
@@ -0,0 +1,369 @@
+/* Streams simulated audio through rocsend as fast as it encodes,
+ * with RTCP pads requested and receiver reports fed back, and checks that
+ * the steady state neither allocates per packet nor grows RSS.
+ *
+ * Allocations are counted on the streaming (test) thread only, through a
+ * counting default GstAllocator and, on glibc, malloc interposition. Run
+ * without GST_DEBUG, debug logging allocates.
+ *
+ * Two minutes of audio by default, enough to catch per-packet allocations.
+ * Long runs go through the environment:
+ *
+ *   ROCSEND_SOAK_SECONDS=36000 meson test --suite soak    # 10 h of audio
+ */
+#include <gst/check/gstcheck.h>
+#include <gst/rtp/gstrtcpbuffer.h>
+#include <math.h>
+#include <unistd.h>
+
+#define RATE 48000
+#define CHANNELS 2
+#define STEP_FRAMES 480 /* 10 ms input buffers */
+#define PACKET_LENGTH (5 * GST_MSECOND)
+#define RTX_HISTORY_SIZE 256
+#define DEFAULT_SOAK_SECONDS 120
+/* Pools, encoder queues and the rtx history fill up during warmup */
+#define WARMUP_SECONDS 30
+#define FEEDBACK_INTERVAL 10 /* steps, 100 ms */
+#define FEEDBACK_SSRC 0x5eedf00d
+#define MAX_MALLOC_PER_PACKET 0.001
+#define MAX_RSS_GROWTH (4 * 1024 * 1024)
+
+static __thread gboolean counting;
+static guint64 memory_allocs;
+static guint64 malloc_calls;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+
+void *
+malloc (size_t size)
+{
+  if (counting)
+    malloc_calls++;
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n, size_t size)
+{
+  if (counting)
+    malloc_calls++;
+  return __libc_calloc (n, size);
+}
+
+void *
+realloc (void *ptr, size_t size)
+{
+  if (counting)
+    malloc_calls++;
+  return __libc_realloc (ptr, size);
+}
+#endif
+
+/* Default allocator that counts and hands out system memory */
+typedef struct {
+  GstAllocator parent;
+  GstAllocator *sysmem;
+} CountingAllocator;
+
+typedef struct {
+  GstAllocatorClass parent_class;
+} CountingAllocatorClass;
+
+GType counting_allocator_get_type (void);
+G_DEFINE_TYPE (CountingAllocator, counting_allocator, GST_TYPE_ALLOCATOR);
+
+static GstMemory *
+counting_alloc (GstAllocator * allocator, gsize size,
+    GstAllocationParams * params)
+{
+  CountingAllocator *self = (CountingAllocator *) allocator;
+
+  if (counting)
+    memory_allocs++;
+  return gst_allocator_alloc (self->sysmem, size, params);
+}
+
+static void
+counting_free (GstAllocator * allocator, GstMemory * memory)
+{
+  /* Memory is owned by sysmem and never comes back here */
+  (void) allocator;
+  gst_allocator_free (memory->allocator, memory);
+}
+
+static void
+counting_allocator_class_init (CountingAllocatorClass * klass)
+{
+  GstAllocatorClass *allocator_class = GST_ALLOCATOR_CLASS (klass);
+
+  allocator_class->alloc = counting_alloc;
+  allocator_class->free = counting_free;
+}
+
+static void
+counting_allocator_init (CountingAllocator * self)
+{
+  self->sysmem = gst_allocator_find (GST_ALLOCATOR_SYSMEM);
+}
+
+typedef struct {
+  guint64 packets;
+  guint64 rtcp_packets;
+  guint32 media_ssrc;
+  guint16 highest_seq;
+  guint32 lsr; /* middle 32 bits of the last SR NTP time */
+  gboolean got_sr;
+} SoakState;
+
+static SoakState state;
+
+static GstFlowReturn
+rtp_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstMapInfo map;
+  (void) pad;
+  (void) parent;
+
+  if (gst_buffer_map (buf, &map, GST_MAP_READ)) {
+    if (map.size >= 12) {
+      state.highest_seq = GST_READ_UINT16_BE (map.data + 2);
+      state.media_ssrc = GST_READ_UINT32_BE (map.data + 8);
+    }
+    gst_buffer_unmap (buf, &map);
+  }
+  state.packets++;
+  gst_buffer_unref (buf);
+  return GST_FLOW_OK;
+}
+
+static GstFlowReturn
+rtcp_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstMapInfo map;
+  (void) pad;
+  (void) parent;
+
+  if (gst_buffer_map (buf, &map, GST_MAP_READ)) {
+    if (map.size >= 28 && map.data[1] == GST_RTCP_TYPE_SR) {
+      state.lsr = GST_READ_UINT32_BE (map.data + 10);
+      state.got_sr = TRUE;
+    }
+    gst_buffer_unmap (buf, &map);
+  }
+  state.rtcp_packets++;
+  gst_buffer_unref (buf);
+  return GST_FLOW_OK;
+}
+
+/* Receiver report with one block about the sent stream */
+static void
+update_feedback (GstBuffer * buf)
+{
+  GstMapInfo map;
+
+  fail_unless (gst_buffer_map (buf, &map, GST_MAP_WRITE));
+  guint8 *p = map.data;
+  memset (p, 0, map.size);
+  p[0] = 0x81;                  /* V=2, one report block */
+  p[1] = GST_RTCP_TYPE_RR;
+  GST_WRITE_UINT16_BE (p + 2, map.size / 4 - 1);
+  GST_WRITE_UINT32_BE (p + 4, FEEDBACK_SSRC);
+  GST_WRITE_UINT32_BE (p + 8, state.media_ssrc);
+  GST_WRITE_UINT32_BE (p + 16, state.highest_seq);
+  GST_WRITE_UINT32_BE (p + 24, state.lsr);
+  gst_buffer_unmap (buf, &map);
+}
+
+static gsize
+read_rss (void)
+{
+  gsize pages = 0;
+  FILE *f = fopen ("/proc/self/statm", "r");
+  if (f) {
+    if (fscanf (f, "%*u %" G_GSIZE_FORMAT, &pages) != 1)
+      pages = 0;
+    fclose (f);
+  }
+  return pages * sysconf (_SC_PAGESIZE);
+}
+
+static GstPad *
+make_pad (const gchar * name, GstPadDirection direction, GstPadChainFunction
+    chain)
+{
+  GstPad *pad = gst_pad_new (name, direction);
+  if (chain)
+    gst_pad_set_chain_function (pad, chain);
+  gst_pad_set_active (pad, TRUE);
+  return pad;
+}
+
+static void
+start_stream (GstPad * pad, const gchar * caps_str)
+{
+  GstSegment segment;
+  GstCaps *caps = gst_caps_from_string (caps_str);
+
+  gst_pad_push_event (pad, gst_event_new_stream_start ("soak"));
+  gst_pad_push_event (pad, gst_event_new_caps (caps));
+  gst_caps_unref (caps);
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  gst_pad_push_event (pad, gst_event_new_segment (&segment));
+}
+
+static GstBufferPool *
+make_input_pool (void)
+{
+  GstBufferPool *pool = gst_buffer_pool_new ();
+  GstStructure *config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, NULL,
+      STEP_FRAMES * CHANNELS * sizeof (gfloat), 4, 0);
+  fail_unless (gst_buffer_pool_set_config (pool, config));
+  fail_unless (gst_buffer_pool_set_active (pool, TRUE));
+  return pool;
+}
+
+GST_START_TEST (test_soak)
+{
+  guint64 seconds = DEFAULT_SOAK_SECONDS;
+  const gchar *env = g_getenv ("ROCSEND_SOAK_SECONDS");
+  if (env)
+    seconds = MAX (WARMUP_SECONDS + 1, g_ascii_strtoull (env, NULL, 10));
+
+  GstAllocator *allocator = g_object_new (counting_allocator_get_type (),
+      NULL);
+  gst_object_ref_sink (allocator);
+  gst_allocator_set_default (gst_object_ref (allocator));
+
+  GstElement *rocsend = gst_element_factory_make ("rocsend", NULL);
+  fail_unless (rocsend != NULL);
+  g_object_set (rocsend, "packet-length", (guint64) PACKET_LENGTH,
+      "rtx-history-size", RTX_HISTORY_SIZE, NULL);
+
+  GstPad *rtcp_src = gst_element_request_pad_simple (rocsend, "rtcp_src_%u");
+  GstPad *rtcp_sink = gst_element_request_pad_simple (rocsend,
+      "rtcp_sink_%u");
+  GstPad *in = make_pad ("in", GST_PAD_SRC, NULL);
+  GstPad *out = make_pad ("out", GST_PAD_SINK, rtp_chain);
+  GstPad *rtcp_out = make_pad ("rtcp_out", GST_PAD_SINK, rtcp_chain);
+  GstPad *rtcp_in = make_pad ("rtcp_in", GST_PAD_SRC, NULL);
+  GstPad *sinkpad = gst_element_get_static_pad (rocsend, "sink");
+  GstPad *srcpad = gst_element_get_static_pad (rocsend, "src");
+  fail_unless_equals_int (gst_pad_link (in, sinkpad), GST_PAD_LINK_OK);
+  fail_unless_equals_int (gst_pad_link (srcpad, out), GST_PAD_LINK_OK);
+  fail_unless_equals_int (gst_pad_link (rtcp_src, rtcp_out), GST_PAD_LINK_OK);
+  fail_unless_equals_int (gst_pad_link (rtcp_in, rtcp_sink), GST_PAD_LINK_OK);
+
+  fail_unless_equals_int (gst_element_set_state (rocsend, GST_STATE_PLAYING),
+      GST_STATE_CHANGE_SUCCESS);
+  start_stream (in, "audio/x-raw,format=F32LE,layout=interleaved,"
+      "rate=48000,channels=2");
+  start_stream (rtcp_in, "application/x-rtcp");
+
+  GstBufferPool *pool = make_input_pool ();
+  GstBuffer *feedback = gst_buffer_new_allocate (NULL, 32, NULL);
+  memset (&state, 0, sizeof (state));
+
+  const guint64 steps = seconds * RATE / STEP_FRAMES;
+  const guint64 warmup_steps = WARMUP_SECONDS * RATE / STEP_FRAMES;
+  guint64 packets_at_warmup = 0;
+  gsize rss_at_warmup = 0;
+  gdouble phase = 0;
+
+  for (guint64 step = 0; step < steps; step++) {
+    if (step == warmup_steps) {
+      packets_at_warmup = state.packets;
+      rss_at_warmup = read_rss ();
+      memory_allocs = malloc_calls = 0;
+    }
+    const gboolean measure = step >= warmup_steps;
+
+    GstBuffer *buf = NULL;
+    fail_unless_equals_int (gst_buffer_pool_acquire_buffer (pool, &buf, NULL),
+        GST_FLOW_OK);
+    GstMapInfo map;
+    gst_buffer_map (buf, &map, GST_MAP_WRITE);
+    gfloat *samples = (gfloat *) map.data;
+    for (guint i = 0; i < STEP_FRAMES; i++) {
+      const gfloat v = 0.5f * sinf (phase);
+      phase += 2 * G_PI * 440 / RATE;
+      for (guint ch = 0; ch < CHANNELS; ch++)
+        samples[i * CHANNELS + ch] = v;
+    }
+    phase = fmod (phase, 2 * G_PI);
+    gst_buffer_unmap (buf, &map);
+    GST_BUFFER_PTS (buf) = gst_util_uint64_scale_int (step * STEP_FRAMES,
+        GST_SECOND, RATE);
+    GST_BUFFER_DURATION (buf) = gst_util_uint64_scale_int (STEP_FRAMES,
+        GST_SECOND, RATE);
+
+    counting = measure;
+    const GstFlowReturn ret = gst_pad_push (in, buf);
+    counting = FALSE;
+    fail_unless_equals_int (ret, GST_FLOW_OK);
+
+    if (step % FEEDBACK_INTERVAL == 0 && state.packets > 0) {
+      update_feedback (feedback);
+      counting = measure;
+      gst_pad_push (rtcp_in, gst_buffer_ref (feedback));
+      counting = FALSE;
+    }
+  }
+
+  const guint64 packets = state.packets - packets_at_warmup;
+  const gsize rss_growth = MAX (read_rss (), rss_at_warmup) - rss_at_warmup;
+  g_print ("soak: %" G_GUINT64_FORMAT " s of audio, %" G_GUINT64_FORMAT
+      " packets measured, %" G_GUINT64_FORMAT " RTCP, memory allocs/packet=%.6f"
+      " malloc/packet=%.6f, RSS %" G_GSIZE_FORMAT " kB -> +%" G_GSIZE_FORMAT
+      " kB\n", seconds, packets, state.rtcp_packets,
+      packets ? (gdouble) memory_allocs / packets : 0,
+      packets ? (gdouble) malloc_calls / packets : 0, rss_at_warmup / 1024,
+      rss_growth / 1024);
+
+  fail_unless (packets > 0);
+  fail_unless (state.got_sr, "no RTCP sender report was sent");
+  fail_unless_equals_uint64 (memory_allocs, 0);
+  fail_unless ((gdouble) malloc_calls / packets <= MAX_MALLOC_PER_PACKET,
+      "%" G_GUINT64_FORMAT " mallocs for %" G_GUINT64_FORMAT " packets",
+      malloc_calls, packets);
+  fail_unless (rss_growth <= MAX_RSS_GROWTH, "RSS grew by %" G_GSIZE_FORMAT
+      " bytes", rss_growth);
+
+  gst_buffer_unref (feedback);
+  gst_buffer_pool_set_active (pool, FALSE);
+  gst_object_unref (pool);
+  gst_element_set_state (rocsend, GST_STATE_NULL);
+  gst_element_release_request_pad (rocsend, rtcp_src);
+  gst_element_release_request_pad (rocsend, rtcp_sink);
+  gst_object_unref (rtcp_src);
+  gst_object_unref (rtcp_sink);
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+  gst_object_unref (in);
+  gst_object_unref (out);
+  gst_object_unref (rtcp_out);
+  gst_object_unref (rtcp_in);
+  gst_object_unref (rocsend);
+  gst_allocator_set_default (gst_allocator_find (GST_ALLOCATOR_SYSMEM));
+  gst_object_unref (allocator);
+}
+GST_END_TEST;
+
+static Suite *
+soak_suite (void)
+{
+  Suite *s = suite_create ("soak");
+  TCase *tc_chain = tcase_create ("general");
+
+  tcase_set_timeout (tc_chain, 0);
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_soak);
+
+  return s;
+}
+
+GST_CHECK_MAIN (soak);
@@ -0,0 +1,128 @@
+/* Measures the time from a PLAYING request to the first RTP packet leaving
+ * rocsend, over repeated READY -> PLAYING -> READY cycles. */
+#include <gst/gst.h>
+
+#define DEFAULT_CYCLES 50
+#define FIRST_PACKET_TIMEOUT (2 * G_TIME_SPAN_SECOND)
+
+#define BENCH_CAPS "audio/x-raw,format=F32LE,rate=44100,channels=2," \
+                   "layout=interleaved"
+
+typedef struct {
+  GMutex lock;
+  GCond cond;
+  GstClockTime first_packet;
+} FirstPacket;
+
+static GstPadProbeReturn
+first_packet_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  FirstPacket *fp = user_data;
+  (void) pad;
+  (void) info;
+
+  g_mutex_lock (&fp->lock);
+  if (!GST_CLOCK_TIME_IS_VALID (fp->first_packet)) {
+    fp->first_packet = gst_util_get_timestamp ();
+    g_cond_signal (&fp->cond);
+  }
+  g_mutex_unlock (&fp->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+run_mode (const gchar * name, const gchar * rocsend_props, guint cycles)
+{
+  GError *err = NULL;
+  gchar *desc = g_strdup_printf ("audiotestsrc is-live=true "
+      "samplesperbuffer=441 ! " BENCH_CAPS " ! rocsend name=snd %s ! "
+      "fakesink name=sink sync=false", rocsend_props);
+  GstElement *pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (!pipeline) {
+    g_printerr ("%s: failed to build pipeline: %s\n", name, err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+
+  FirstPacket fp;
+  g_mutex_init (&fp.lock);
+  g_cond_init (&fp.cond);
+
+  GstElement *sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad *sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, first_packet_probe,
+      &fp, NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (sink);
+
+  GstClockTime min = GST_CLOCK_TIME_NONE, max = 0, total = 0;
+  guint measured = 0;
+  gboolean ok = TRUE;
+
+  gst_element_set_state (pipeline, GST_STATE_READY);
+  gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+  for (guint i = 0; i < cycles; i++) {
+    g_mutex_lock (&fp.lock);
+    fp.first_packet = GST_CLOCK_TIME_NONE;
+    g_mutex_unlock (&fp.lock);
+
+    const GstClockTime start = gst_util_get_timestamp ();
+    gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+    const gint64 deadline = g_get_monotonic_time () + FIRST_PACKET_TIMEOUT;
+    g_mutex_lock (&fp.lock);
+    while (!GST_CLOCK_TIME_IS_VALID (fp.first_packet))
+      if (!g_cond_wait_until (&fp.cond, &fp.lock, deadline))
+        break;
+    const GstClockTime first = fp.first_packet;
+    g_mutex_unlock (&fp.lock);
+
+    gst_element_set_state (pipeline, GST_STATE_READY);
+    gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+    if (!GST_CLOCK_TIME_IS_VALID (first)) {
+      g_printerr ("%s: no packet within timeout on cycle %u\n", name, i);
+      ok = FALSE;
+      break;
+    }
+
+    const GstClockTime delta = first - start;
+    min = MIN (min, delta);
+    max = MAX (max, delta);
+    total += delta;
+    measured++;
+  }
+
+  if (measured > 0)
+    g_print ("%-24s cycles=%-4u min=%" GST_TIME_FORMAT " mean=%"
+        GST_TIME_FORMAT " max=%" GST_TIME_FORMAT "\n", name, measured,
+        GST_TIME_ARGS (min), GST_TIME_ARGS (total / measured),
+        GST_TIME_ARGS (max));
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_mutex_clear (&fp.lock);
+  g_cond_clear (&fp.cond);
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  guint cycles = DEFAULT_CYCLES;
+
+  gst_init (&argc, &argv);
+  if (argc > 1)
+    cycles = (guint) g_ascii_strtoull (argv[1], NULL, 10);
+
+  gboolean ok = run_mode ("lazy (default)", "", cycles);
+  ok &= run_mode ("prewarm-caps", "prewarm-caps=\"" BENCH_CAPS "\"", cycles);
+  ok &= run_mode ("prewarm+keep-encoder", "prewarm-caps=\"" BENCH_CAPS "\" "
+      "keep-encoder-on-stop=true", cycles);
+
+  gst_deinit ();
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/* Runs a short pipeline under the rocsend tracer and checks the counters it
+ * writes to CSV when GStreamer is torn down */
+#include <gst/check/gstcheck.h>
+#include <glib/gstdio.h>
+
+#define NUM_BUFFERS 50
+
+static gchar *trace_file;
+
+/* Total count of @metric for @element over all histogram buckets */
+static guint64
+sum_metric (const gchar * csv, const gchar * element, const gchar * metric)
+{
+  gchar **lines = g_strsplit (csv, "\n", -1);
+  guint64 total = 0;
+
+  for (guint i = 1; lines[i]; i++) {
+    gchar **fields = g_strsplit (lines[i], ",", -1);
+    if (g_strv_length (fields) == 5 && g_str_equal (fields[0], element) &&
+        g_str_equal (fields[1], metric))
+      total += g_ascii_strtoull (fields[4], NULL, 10);
+    g_strfreev (fields);
+  }
+  g_strfreev (lines);
+  return total;
+}
+
+GST_START_TEST (test_tracer_counters)
+{
+  gchar *desc = g_strdup_printf ("audiotestsrc num-buffers=%d "
+      "samplesperbuffer=441 ! audio/x-raw,format=F32LE,rate=44100,"
+      "channels=2 ! rocsend name=send ! fakesink sync=true", NUM_BUFFERS);
+  GstElement *pipeline = gst_parse_launch (desc, NULL);
+  g_free (desc);
+  fail_unless (pipeline != NULL);
+
+  fail_unless (gst_element_set_state (pipeline, GST_STATE_PLAYING) !=
+      GST_STATE_CHANGE_FAILURE);
+  GstBus *bus = gst_element_get_bus (pipeline);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, 10 * GST_SECOND,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  fail_unless (msg != NULL);
+  fail_unless_equals_int (GST_MESSAGE_TYPE (msg), GST_MESSAGE_EOS);
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  /* The stats outlive the element, the tracer dumps them on deinit */
+  gst_deinit ();
+
+  gchar *csv = NULL;
+  fail_unless (g_file_get_contents (trace_file, &csv, NULL, NULL));
+  fail_unless (g_str_has_prefix (csv,
+          "element,metric,bucket_low_ns,bucket_high_ns,count\n"));
+  fail_unless_equals_uint64 (sum_metric (csv, "send", "push-frame"),
+      NUM_BUFFERS);
+  fail_unless (sum_metric (csv, "send", "pop-packet") > 0);
+  fail_unless (sum_metric (csv, "send", "capture-latency") > 0);
+  g_free (csv);
+}
+GST_END_TEST;
+
+static Suite *
+tracer_suite (void)
+{
+  Suite *s = suite_create ("tracer");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_tracer_counters);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  /* Tracers are set up by gst_init, so the environment comes first */
+  gint fd = g_file_open_tmp ("rocsend-trace-XXXXXX.csv", &trace_file, NULL);
+  g_assert (fd >= 0);
+  g_close (fd, NULL);
+  gchar *tracers = g_strdup_printf ("rocsend(file=%s)", trace_file);
+  g_setenv ("GST_TRACERS", tracers, TRUE);
+  g_free (tracers);
+
+  gst_check_init (&argc, &argv);
+  const int ret = gst_check_run_suite (tracer_suite (), "tracer", __FILE__);
+
+  g_unlink (trace_file);
+  g_free (trace_file);
+  return ret;
+}